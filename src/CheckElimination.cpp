@@ -0,0 +1,236 @@
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <map>
+#include <tuple>
+#include "KintChecks.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumMerged,  "Number of checks merged into a dominating identical check");
+STATISTIC(NumHoisted, "Number of loop-invariant checks hoisted to a preheader");
+
+namespace {
+
+// Runs between kint-check-insertion and kint-smt-query to cut the number of
+// checks, and hence solver queries, without losing any report: a check
+// dominated by an identical one can only fail if the dominating one can.
+struct CheckElimination : public FunctionPass {
+  static char ID; // Pass identification
+  CheckElimination() : FunctionPass(ID) {}
+
+  bool runOnFunction(Function &);
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.setPreservesCFG();
+  }
+
+private:
+  // (opcode, operand 0, operand 1, signed) of the guarded operation
+  typedef std::tuple<unsigned, Value *, Value *, bool> CheckKey;
+
+  static bool hoist(CallInst *, DominatorTree &, LoopInfo &);
+  static void tagSite(CallInst *);
+  static bool isGuaranteedToExecute(CallInst *, Loop *, DominatorTree &, LoopInfo &);
+  static bool collectHoistable(Value *, Loop *, SmallVectorImpl<Instruction *> &);
+};
+
+} // End anonymous namespace
+
+char CheckElimination::ID = 0;
+
+static RegisterPass<CheckElimination> X("kint-check-elim",
+          "Redundant check elimination and hoisting for Kint",
+          false /* does not modify the CFG */,
+          false /* transformation, not just analysis */);
+
+bool CheckElimination::runOnFunction(Function &F) {
+  auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  std::map<CheckKey, SmallVector<CallInst *, 4>> checks;
+  bool Changed = false;
+
+  // Keys have to be taken while every check still sits right before the
+  // operation it guards.
+  for (auto &BB: F) {
+    for (auto &I: BB) {
+      auto type = matchKintCheck(&I);
+      if (!type)
+        continue;
+
+      auto *CI = cast<CallInst>(&I);
+      auto *BO = dyn_cast<BinaryOperator>(getCheckedInst(CI));
+      if (!BO)
+        continue;
+
+      bool isSigned = false;
+      if (type == KINT_OVERFLOW)
+        isSigned = !cast<ConstantInt>(CI->getArgOperand(3))->isZero();
+
+      checks[CheckKey(BO->getOpcode(), BO->getOperand(0), BO->getOperand(1), isSigned)]
+        .push_back(CI);
+    }
+  }
+
+  for (auto &KV: checks) {
+    for (auto *CI: KV.second) {
+      if (hoist(CI, DT, LI)) {
+        Changed = true;
+        ++NumHoisted;
+      }
+    }
+  }
+
+  // Strict dominance is acyclic, so every dominated check has a surviving
+  // dominator and all of them can be dropped at once.
+  for (auto &KV: checks) {
+    auto &sites = KV.second;
+    SmallVector<CallInst *, 4> dominated;
+
+    for (auto *CI: sites) {
+      for (auto *Other: sites) {
+        if (Other != CI && DT.dominates(Other, CI)) {
+          dominated.push_back(CI);
+          break;
+        }
+      }
+    }
+
+    for (auto *CI: dominated) {
+      SmallVector<Value *, 4> args(CI->args());
+      CI->eraseFromParent();
+      for (auto *V: args)
+        RecursivelyDeleteTriviallyDeadInstructions(V);
+      Changed = true;
+      ++NumMerged;
+    }
+  }
+
+  return Changed;
+}
+
+// Move CI, and the comparisons that check insertion added to feed it, to the
+// preheader of every enclosing loop it is invariant in. Only done when the
+// check would run on the first trip through the loop anyway, so no new
+// reports are introduced. Instructions of the program itself stay put.
+bool CheckElimination::hoist(CallInst *CI, DominatorTree &DT, LoopInfo &LI) {
+  bool Hoisted = false;
+
+  for (auto *L = LI.getLoopFor(CI->getParent()); L; L = LI.getLoopFor(CI->getParent())) {
+    auto *Preheader = L->getLoopPreheader();
+    if (!Preheader || !isGuaranteedToExecute(CI, L, DT, LI))
+      break;
+
+    SmallVector<Instruction *, 4> helpers;
+    bool Invariant = true;
+    for (auto &V: CI->args()) {
+      if (!collectHoistable(V, L, helpers)) {
+        Invariant = false;
+        break;
+      }
+    }
+    if (!Invariant)
+      break;
+
+    if (!Hoisted)
+      tagSite(CI);
+    for (auto *I: helpers)
+      I->moveBefore(Preheader->getTerminator());
+    CI->moveBefore(Preheader->getTerminator());
+    Hoisted = true;
+  }
+
+  return Hoisted;
+}
+
+// Whether V is invariant in L once the instructions added to helpers, in
+// operand-first order, are moved out. Only the comparisons and logic that
+// compute a check's condition may be moved: starting from the arguments of
+// the check, an instruction with a single use is only used by the check.
+// The operands of the checked operation are used by it too.
+bool CheckElimination::collectHoistable(Value *V, Loop *L, SmallVectorImpl<Instruction *> &helpers) {
+  if (L->isLoopInvariant(V))
+    return true;
+
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || !I->hasOneUse() || !isSafeToSpeculativelyExecute(I) || I->mayReadFromMemory() ||
+      !(isa<CmpInst>(I) || isa<BinaryOperator>(I) || isa<BitCastInst>(I)))
+    return false;
+  for (auto &Op: I->operands()) {
+    if (!collectHoistable(Op, L, helpers))
+      return false;
+  }
+  helpers.push_back(I);
+  return true;
+}
+
+// Remember which instruction CI guards before it leaves its side.
+void CheckElimination::tagSite(CallInst *CI) {
+  auto *I = getCheckedInst(CI);
+  auto *site = MDNode::getDistinct(CI->getContext(), None);
+  CI->setMetadata(KINT_SITE_MD, site);
+  I->setMetadata(KINT_SITE_MD, site);
+}
+
+// Whether every trip through L that leaves it or starts over runs CI first,
+// and the first trip reaches CI: L has an exit, CI's block dominates every
+// exit and latch, and nothing before CI in the trip may loop, throw or not
+// return. A loop without an exit may spin without ever running CI.
+bool CheckElimination::isGuaranteedToExecute(CallInst *CI, Loop *L, DominatorTree &DT,
+                                             LoopInfo &LI) {
+  auto *BB = CI->getParent();
+  SmallVector<BasicBlock *, 8> exiting, latches;
+  L->getExitingBlocks(exiting);
+  L->getLoopLatches(latches);
+  if (exiting.empty())
+    return false;
+  for (auto *E: exiting) {
+    if (!DT.dominates(BB, E))
+      return false;
+  }
+  for (auto *Latch: latches) {
+    if (!DT.dominates(BB, Latch))
+      return false;
+  }
+
+  // Checks themselves only mark a site.
+  auto mayStop = [](Instruction &I) {
+    return !matchKintCheck(&I) && !isGuaranteedToTransferExecutionToSuccessor(&I);
+  };
+
+  // The blocks run before BB within a trip: its predecessors back to the
+  // header, none of them in an inner loop.
+  SmallVector<BasicBlock *, 8> worklist;
+  SmallPtrSet<BasicBlock *, 8> visited;
+  if (BB != L->getHeader())
+    worklist.append(pred_begin(BB), pred_end(BB));
+  while (!worklist.empty()) {
+    auto *Pred = worklist.pop_back_val();
+    if (!visited.insert(Pred).second)
+      continue;
+    if (LI.getLoopFor(Pred) != L || any_of(*Pred, mayStop))
+      return false;
+    if (Pred != L->getHeader())
+      worklist.append(pred_begin(Pred), pred_end(Pred));
+  }
+
+  for (auto &I: *BB) {
+    if (&I == CI)
+      break;
+    if (mayStop(I))
+      return false;
+  }
+  return true;
+}
@@ -30,14 +30,28 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <cstdint>
 #include <sstream>
 #include "CompilerAttributes.h"
+#include "DiffScope.h"
 
 using namespace llvm;
 
+static cl::opt<std::string> DiffFile("kint-diff",
+  cl::desc("Only check operations on the lines added or changed by this "
+           "unified diff"),
+  cl::value_desc("file"));
+
+static cl::list<std::string> ChangedLines("kint-changed-lines", cl::CommaSeparated,
+  cl::desc("Only check operations on these lines"),
+  cl::value_desc("file:line[-line]"));
+
 STATISTIC(NumInserted,  "Number of bounds check inserted");
+STATISTIC(NumOutOfScope, "Number of operations outside the changed lines left unchecked");
+STATISTIC(NumFunctionsOutOfScope, "Number of functions without a changed line skipped");
 
 namespace { // Begin anonymous namespace
 
@@ -46,6 +60,7 @@ struct CheckInsertion : public FunctionPass {
   CheckInsertion() : FunctionPass(ID) {}
 
   // Entry point
+  bool doInitialization(Module &);
   bool runOnFunction(Function &);
 
   // getAnalysisUsage - List passes required by this pass.  We also know it
@@ -55,10 +70,16 @@ struct CheckInsertion : public FunctionPass {
   }
 
 private:
+  // See -kint-diff and -kint-changed-lines
+  DiffScope scope;
+  bool scoped = false;
+
   // Add fields and helper functions for this pass here.
+  bool isInScope(Function &);
   void insertOverflowCheck(BinaryOperator *);
   void insertShiftCheck(BinaryOperator *);
   void insertDivCheck(BinaryOperator *);
+  static Value *anyLane(Value *, Instruction *);
   static bool isObservable(Instruction *);
 };
 
@@ -82,10 +103,23 @@ bool CheckInsertion::runOnFunction(Function &F) {
 
   bool Changed = false;
 
+  if (scoped && !isInScope(F)) {
+    ++NumFunctionsOutOfScope;
+    return false;
+  }
+
   for (auto &BB: F) {
     for (auto &I: BB) {
       auto *BO = dyn_cast<BinaryOperator>(&I);
-      if (!BO || !isObservable(BO))
+      // Lanes of scalable vectors cannot be counted.
+      if (!BO || isa<ScalableVectorType>(BO->getType()))
+        continue;
+      // Inlined copies keep the location of the original.
+      if (scoped && !scope.contains(BO->getDebugLoc())) {
+        ++NumOutOfScope;
+        continue;
+      }
+      if (!isObservable(BO))
         continue;
 
       switch (BO->getOpcode()) {
@@ -121,6 +155,30 @@ bool CheckInsertion::runOnFunction(Function &F) {
   return Changed;
 }
 
+bool CheckInsertion::doInitialization(Module &M) {
+  std::string err;
+  scope = DiffScope();
+  scoped = !DiffFile.empty() || !ChangedLines.empty();
+  if (!DiffFile.empty() && !scope.loadDiff(DiffFile, err))
+    report_fatal_error(Twine("cannot read diff '") + DiffFile + "': " + err, false);
+  for (auto &spec: ChangedLines) {
+    if (!scope.addRange(spec, err))
+      report_fatal_error(Twine("invalid -kint-changed-lines: ") + err, false);
+  }
+  return false;
+}
+
+// Whether any instruction of F is on a changed line
+bool CheckInsertion::isInScope(Function &F) {
+  for (auto &BB: F) {
+    for (auto &I: BB) {
+      if (scope.contains(I.getDebugLoc()))
+        return true;
+    }
+  }
+  return false;
+}
+
 void CheckInsertion::insertOverflowCheck(BinaryOperator *BO) {
   auto *M = BO->getModule();
   auto &C = M->getContext();
@@ -149,15 +207,15 @@ void CheckInsertion::insertShiftCheck(BinaryOperator *BO) {
   auto &C = M->getContext();
 
   auto amount = BO->getOperand(1);
-  auto width = cast<IntegerType>(BO->getOperand(0)->getType())->getBitWidth();
-  auto amountWidth = cast<IntegerType>(amount->getType())->getBitWidth();
+  auto width = BO->getOperand(0)->getType()->getScalarSizeInBits();
+  auto amountWidth = amount->getType()->getScalarSizeInBits();
   auto limit = Constant::getIntegerValue(amount->getType(), APInt(amountWidth, width));
   auto result = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_UGE, amount, limit, "", BO);
 
   Type *ArgTys[1] = { Type::getInt1Ty(C) };
   auto *FnTy = FunctionType::get(Type::getVoidTy(C), ArgTys, false);
   auto F = M->getOrInsertFunction("__kint_shift_div", FnTy);
-  Value *Args[1] = { result };
+  Value *Args[1] = { anyLane(result, BO) };
   CallInst::Create(F, Args, "", BO);
 
   NumInserted += 1;
@@ -168,7 +226,7 @@ void CheckInsertion::insertDivCheck(BinaryOperator *BO) {
   auto &C = M->getContext();
 
   auto divisor = BO->getOperand(1);
-  auto divisorWidth = cast<IntegerType>(divisor->getType())->getBitWidth();
+  auto divisorWidth = divisor->getType()->getScalarSizeInBits();
   auto zero = Constant::getIntegerValue(divisor->getType(), APInt::getNullValue(divisorWidth));
   Value *isErr = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_EQ, divisor, zero, "", BO);
 
@@ -176,7 +234,7 @@ void CheckInsertion::insertDivCheck(BinaryOperator *BO) {
     auto negOne = Constant::getIntegerValue(divisor->getType(), APInt::getAllOnesValue(divisorWidth));
 
     auto dividend = BO->getOperand(0);
-    auto dividendWidth = cast<IntegerType>(dividend->getType())->getBitWidth();
+    auto dividendWidth = dividend->getType()->getScalarSizeInBits();
     auto min = Constant::getIntegerValue(dividend->getType(), APInt::getSignedMinValue(dividendWidth));
 
     auto isNegOne = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_EQ, divisor, negOne, "", BO);
@@ -189,12 +247,25 @@ void CheckInsertion::insertDivCheck(BinaryOperator *BO) {
   Type *ArgTys[1] = { Type::getInt1Ty(C) };
   auto *FnTy = FunctionType::get(Type::getVoidTy(C), ArgTys, false);
   auto F = M->getOrInsertFunction("__kint_shift_div", FnTy);
-  Value *Args[1] = { isErr };
+  Value *Args[1] = { anyLane(isErr, BO) };
   CallInst::Create(F, Args, "", BO);
 
   NumInserted += 1;
 }
 
+// Whether any lane of the i1 or <N x i1> Cond is set; one check covers all
+// the lanes of a vector operation.
+Value *CheckInsertion::anyLane(Value *Cond, Instruction *InsertBefore) {
+  auto *VTy = dyn_cast<FixedVectorType>(Cond->getType());
+  if (!VTy)
+    return Cond;
+
+  auto *IntTy = Type::getIntNTy(Cond->getContext(), VTy->getNumElements());
+  auto *bits = new BitCastInst(Cond, IntTy, "", InsertBefore);
+  auto *zero = Constant::getNullValue(IntTy);
+  return CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_NE, bits, zero, "", InsertBefore);
+}
+
 bool CheckInsertion::isObservable(Instruction *I) {
   SmallVector<Instruction *, 16> insts;
   SmallPtrSet<Value *, 16> visited;
@@ -0,0 +1,135 @@
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/Format.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include "CheckSampler.h"
+#include "ReportSink.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumSampled, "Number of checks solved as part of the -kint-sample sample");
+
+// Strata within a check kind, by instruction count
+static const unsigned NumSizeClasses = 3;
+static const char *const SizeClassNames[NumSizeClasses] = { "<100", "100-999", ">=1000" };
+
+static unsigned getSizeClass(const Function &F) {
+  auto size = F.getInstructionCount();
+  return size < 100 ? 0 : size < 1000 ? 1 : 2;
+}
+
+void CheckSampler::add(Function &F, BackEdges edges, Checks checks) {
+  auto sizeClass = getSizeClass(F);
+  for (auto &C: checks)
+    sites.push_back(Site{ C.first, C.second, C.second * NumSizeClasses + sizeClass });
+  if (!checks.empty())
+    backEdges[&F].assign(edges.begin(), edges.end());
+}
+
+// Each stratum contributes the same fraction of its checks, but at least two
+// where it has them so that its variance can be estimated. Unknown answers
+// are left out of the SAT estimate.
+void CheckSampler::solve(raw_ostream &OS,
+                         function_ref<void(Function &, BackEdges, Checks)> startFunction,
+                         function_ref<SolveResult(CallInst *, BackEdges, KINT_TYPE)> solveCheck) {
+  struct Stratum {
+    size_t total = 0, sampled = 0, sat = 0, unknown = 0;
+    double seconds = 0, squares = 0;
+  };
+  std::map<unsigned, Stratum> strata;
+  std::map<unsigned, std::vector<size_t>> members;
+  for (size_t i = 0; i < sites.size(); ++i) {
+    ++strata[sites[i].stratum].total;
+    members[sites[i].stratum].push_back(i);
+  }
+
+  std::mt19937_64 rng(seed);
+  std::vector<size_t> sample;
+  for (auto &M: members) {
+    auto &indexes = M.second;
+    auto n = std::max<size_t>(2, std::ceil(rate * indexes.size()));
+    n = std::min(n, indexes.size());
+    std::shuffle(indexes.begin(), indexes.end(), rng);
+    sample.insert(sample.end(), indexes.begin(), indexes.begin() + n);
+  }
+  std::sort(sample.begin(), sample.end());
+
+  auto measured = std::chrono::steady_clock::now();
+  for (size_t begin = 0; begin < sample.size();) {
+    auto *F = sites[sample[begin]].CI->getFunction();
+    SmallVector<std::pair<CallInst *, KINT_TYPE>, 32> checks;
+    auto end = begin;
+    for (; end < sample.size() && sites[sample[end]].CI->getFunction() == F; ++end)
+      checks.emplace_back(sites[sample[end]].CI, sites[sample[end]].type);
+
+    auto &edges = backEdges[F];
+    startFunction(*F, edges, checks);
+
+    for (auto i: makeArrayRef(sample).slice(begin, end - begin)) {
+      auto &site = sites[i];
+      auto &S = strata[site.stratum];
+      auto start = std::chrono::steady_clock::now();
+      auto result = solveCheck(site.CI, edges, site.type);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      ++S.sampled;
+      S.sat += result == SOLVE_SAT;
+      S.unknown += result == SOLVE_UNKNOWN;
+      S.seconds += elapsed.count();
+      S.squares += elapsed.count() * elapsed.count();
+      ++NumSampled;
+    }
+    begin = end;
+  }
+  std::chrono::duration<double> spent = std::chrono::steady_clock::now() - measured;
+
+  // Totals over strata, with the variance of a stratified estimate under
+  // sampling without replacement; a stratum with a single answer is given
+  // the largest variance a proportion can have.
+  double satEst = 0, satVar = 0, timeEst = 0, timeVar = 0;
+  size_t sampled = 0, sat = 0, unsat = 0;
+  OS << "Sampled checks by stratum (seed " << seed << "):\n";
+  for (auto &KV: strata) {
+    auto &S = KV.second;
+    double N = S.total, n = S.sampled, m = S.sampled - S.unknown;
+    double fpc = 1 - n / N;
+    if (m > 0) {
+      double p = S.sat / m;
+      satEst += N * p;
+      satVar += m > 1 ? N * N * (1 - m / N) * p * (1 - p) / (m - 1) : N * N * (1 - m / N) / 4;
+    } else {
+      satEst += N / 2;
+      satVar += N * N / 4;
+    }
+    double mean = S.seconds / n;
+    timeEst += N * mean;
+    if (n > 1)
+      timeVar += N * N * fpc * std::max(0.0, (S.squares - n * mean * mean) / (n - 1)) / n;
+    sampled += S.sampled;
+    sat += S.sat;
+    unsat += S.sampled - S.sat - S.unknown;
+
+    OS << "  " << ReportSink::getKindName(static_cast<KINT_TYPE>(KV.first / NumSizeClasses))
+       << " in functions of " << SizeClassNames[KV.first % NumSizeClasses] << " insts: "
+       << S.sampled << " of " << S.total << ", " << S.sat << " sat, "
+       << S.unknown << " unknown, " << format("%.3f", mean) << " s/query\n";
+  }
+
+  static const double z = 1.96;
+  double satLo = std::max<double>(sat, satEst - z * std::sqrt(satVar));
+  double satHi = std::min<double>(sites.size() - unsat, satEst + z * std::sqrt(satVar));
+  double timeLo = std::max(0.0, timeEst - z * std::sqrt(timeVar));
+  double timeHi = timeEst + z * std::sqrt(timeVar);
+  OS << "Solved " << sampled << " of " << sites.size() << " checks in "
+     << format("%.2f", spent.count()) << " s\n"
+     << "Estimated sat checks: " << format("%.1f", satEst) << " (95% CI "
+     << format("%.1f", satLo) << " to " << format("%.1f", satHi) << ")\n"
+     << "Projected solve time: " << format("%.2f", timeEst) << " s (95% CI "
+     << format("%.2f", timeLo) << " to " << format("%.2f", timeHi) << ")\n";
+
+  sites.clear();
+  backEdges.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef CHECKSAMPLER_H
+#define CHECKSAMPLER_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+#include <map>
+#include <utility>
+#include <vector>
+#include "KintChecks.h"
+#include "SolverPool.h"
+
+// Solves a stratified random sample of the checks of a module and
+// extrapolates to every check, for -kint-sample. Strata are the check kind
+// and the instruction count of the function.
+class CheckSampler {
+public:
+  typedef llvm::ArrayRef<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> BackEdges;
+  typedef llvm::ArrayRef<std::pair<llvm::CallInst *, KINT_TYPE>> Checks;
+
+  // rate is the fraction of each stratum to solve.
+  CheckSampler(double rate, unsigned seed) : rate(rate), seed(seed) {}
+
+  // Add the checks of F, the sample being drawn once all are known.
+  void add(llvm::Function &F, BackEdges, Checks);
+
+  // Draw the sample and solve it in module order, calling startFunction
+  // before the checks of each function and solveCheck on each check. The
+  // results by stratum and the estimates for every check go to OS.
+  void solve(llvm::raw_ostream &OS,
+             llvm::function_ref<void(llvm::Function &, BackEdges, Checks)> startFunction,
+             llvm::function_ref<SolveResult(llvm::CallInst *, BackEdges, KINT_TYPE)> solveCheck);
+
+private:
+  struct Site {
+    llvm::CallInst *CI;
+    KINT_TYPE type;
+    unsigned stratum;
+  };
+
+  double rate;
+  unsigned seed;
+  // Every check added in order, and the back edges of their functions
+  std::vector<Site> sites;
+  std::map<const llvm::Function *,
+           llvm::SmallVector<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, 16>>
+    backEdges;
+};
+
+#endif
@@ -0,0 +1,505 @@
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Operator.h>
+#include "ConcreteEval.h"
+
+using namespace llvm;
+
+static uint64_t maskOf(unsigned width) {
+  return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+static int64_t sextOf(uint64_t v, unsigned width) {
+  return width >= 64 ? static_cast<int64_t>(v) :
+                       static_cast<int64_t>(v << (64 - width)) >> (64 - width);
+}
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void ConcreteEvaluator::startBatch(unsigned batch) {
+  this->batch = batch;
+  storage.clear();
+  values.clear();
+  blocks.clear();
+  edges.clear();
+  leaves.clear();
+  pins.clear();
+}
+
+ConcreteEvaluator::LaneValues &ConcreteEvaluator::alloc(unsigned width) {
+  storage.emplace_back();
+  storage.back().width = width;
+  return storage.back();
+}
+
+ConcreteEvaluator::LaneValues &ConcreteEvaluator::unknown() {
+  auto &LV = alloc(0);
+  LV.known = false;
+  return LV;
+}
+
+const ConcreteEvaluator::LaneValues &ConcreteEvaluator::eval(Value *V) {
+  auto it = values.find(V);
+  if (it != values.end())
+    return *it->second;
+
+  auto *Ty = V->getType();
+  if (!Ty->isSized() || Ty->isVectorTy() || DL.getTypeSizeInBits(Ty) > 64 ||
+      DL.getTypeSizeInBits(Ty) == 0)
+    return *(values[V] = &unknown());
+
+  auto &LV = alloc(DL.getTypeSizeInBits(Ty));
+  values[V] = &LV;
+
+  if (auto *I = dyn_cast<Instruction>(V)) {
+    evalInst(I, LV);
+  } else if (auto *C = dyn_cast<ConstantInt>(V)) {
+    std::fill(LV.v, LV.v + Lanes, C->getZExtValue());
+  } else if (isa<ConstantPointerNull>(V)) {
+    std::fill(LV.v, LV.v + Lanes, 0);
+  } else if (isa<GEPOperator>(V)) {
+    // Constant address arithmetic, not worth modelling
+    LV.known = false;
+  } else {
+    sample(V, LV);
+  }
+  return LV;
+}
+
+void ConcreteEvaluator::evalInst(Instruction *I, LaneValues &LV) {
+  auto width = LV.width;
+  auto mask = maskOf(width);
+
+  auto unary = [&](Value *Op, function_ref<uint64_t(uint64_t, unsigned)> f) {
+    auto &A = eval(Op);
+    if (!A.known) {
+      LV.known = false;
+      return;
+    }
+    for (unsigned l = 0; l < Lanes; ++l)
+      LV.v[l] = f(A.v[l], A.width) & mask;
+  };
+  auto copy = [](uint64_t v, unsigned) { return v; };
+
+  if (auto *BO = dyn_cast<BinaryOperator>(I)) {
+    evalBinOp(BO, LV);
+  } else if (auto *ICI = dyn_cast<ICmpInst>(I)) {
+    evalICmp(ICI, LV);
+  } else if (isa<GetElementPtrInst>(I)) {
+    LV.known = false;
+  } else if (isa<TruncInst>(I) || isa<ZExtInst>(I)) {
+    unary(I->getOperand(0), copy);
+  } else if (isa<SExtInst>(I)) {
+    unary(I->getOperand(0), [](uint64_t v, unsigned w) {
+      return static_cast<uint64_t>(sextOf(v, w));
+    });
+  } else if (auto *SI = dyn_cast<SelectInst>(I)) {
+    auto &C = eval(SI->getCondition());
+    auto &T = eval(SI->getTrueValue());
+    auto &E = eval(SI->getFalseValue());
+    if (!C.known || !T.known || !E.known) {
+      LV.known = false;
+      return;
+    }
+    for (unsigned l = 0; l < Lanes; ++l)
+      LV.v[l] = (C.v[l] & 1) ? T.v[l] : E.v[l];
+  } else if (isa<BitCastInst>(I)) {
+    auto *SrcTy = I->getOperand(0)->getType();
+    if (SrcTy->isIntegerTy() || SrcTy->isPointerTy())
+      unary(I->getOperand(0), copy);
+    else if (SrcTy->isVectorTy())
+      // Computed from lanes not evaluated here, so not a free input either
+      LV.known = false;
+    else
+      sample(I, LV);
+  } else if (isa<IntToPtrInst>(I) || isa<PtrToIntInst>(I)) {
+    // Truncation or zero extension, like ValueConstraint
+    unary(I->getOperand(0), copy);
+  } else if (auto *PN = dyn_cast<PHINode>(I)) {
+    evalPHI(PN, LV);
+  } else if (auto *CI = dyn_cast<CallInst>(I)) {
+    if (isOpaqueCall(CI))
+      sample(CI, LV);
+    else
+      LV.known = false;
+  } else if (isa<LoadInst>(I) || isa<AllocaInst>(I) || isa<ExtractValueInst>(I) ||
+             isa<InvokeInst>(I) || isa<CastInst>(I) || isa<UnaryOperator>(I) ||
+             isa<FCmpInst>(I) || isa<FreezeInst>(I) || isa<VAArgInst>(I) ||
+             isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I) || isa<LandingPadInst>(I)) {
+    // Free variables of ValueConstraint too
+    sample(I, LV);
+  } else {
+    // Computed by ValueConstraint in ways not evaluated here, such as the
+    // lanes of extractelement, so not a free input either
+    LV.known = false;
+  }
+}
+
+// SMT-LIB semantics throughout, division by zero included.
+void ConcreteEvaluator::evalBinOp(BinaryOperator *BO, LaneValues &LV) {
+  auto &A = eval(BO->getOperand(0));
+  auto &B = eval(BO->getOperand(1));
+  if (!A.known || !B.known) {
+    LV.known = false;
+    return;
+  }
+
+  auto w = LV.width;
+  auto m = maskOf(w);
+  auto smin = 1ULL << (w - 1);
+  const uint64_t *a = A.v, *b = B.v;
+  uint64_t *r = LV.v;
+
+  switch (BO->getOpcode()) {
+  case Instruction::Add:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = (a[l] + b[l]) & m;
+    break;
+  case Instruction::Sub:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = (a[l] - b[l]) & m;
+    break;
+  case Instruction::Mul:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = (a[l] * b[l]) & m;
+    break;
+  case Instruction::UDiv:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = b[l] ? a[l] / b[l] : m;
+    break;
+  case Instruction::URem:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = b[l] ? a[l] % b[l] : a[l];
+    break;
+  case Instruction::SDiv:
+    for (unsigned l = 0; l < Lanes; ++l) {
+      auto sa = sextOf(a[l], w), sb = sextOf(b[l], w);
+      if (!sb)
+        r[l] = sa < 0 ? 1 : m;
+      else if (a[l] == smin && b[l] == m)
+        r[l] = a[l];
+      else
+        r[l] = static_cast<uint64_t>(sa / sb) & m;
+    }
+    break;
+  case Instruction::SRem:
+    for (unsigned l = 0; l < Lanes; ++l) {
+      auto sa = sextOf(a[l], w), sb = sextOf(b[l], w);
+      if (!sb)
+        r[l] = a[l];
+      else if (b[l] == m)
+        r[l] = 0;
+      else
+        r[l] = static_cast<uint64_t>(sa % sb) & m;
+    }
+    break;
+  case Instruction::Shl:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = b[l] >= w ? 0 : (a[l] << b[l]) & m;
+    break;
+  case Instruction::LShr:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = b[l] >= w ? 0 : a[l] >> b[l];
+    break;
+  case Instruction::AShr:
+    for (unsigned l = 0; l < Lanes; ++l) {
+      auto sa = sextOf(a[l], w);
+      r[l] = b[l] >= w ? (sa < 0 ? m : 0) : static_cast<uint64_t>(sa >> b[l]) & m;
+    }
+    break;
+  case Instruction::And:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = a[l] & b[l];
+    break;
+  case Instruction::Or:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = a[l] | b[l];
+    break;
+  case Instruction::Xor:
+    for (unsigned l = 0; l < Lanes; ++l) r[l] = a[l] ^ b[l];
+    break;
+  default:
+    LV.known = false;
+    break;
+  }
+}
+
+void ConcreteEvaluator::evalICmp(ICmpInst *ICI, LaneValues &LV) {
+  auto &A = eval(ICI->getOperand(0));
+  auto &B = eval(ICI->getOperand(1));
+  if (!A.known || !B.known) {
+    LV.known = false;
+    return;
+  }
+
+  auto w = A.width;
+  auto pred = ICI->getPredicate();
+  for (unsigned l = 0; l < Lanes; ++l) {
+    auto a = A.v[l], b = B.v[l];
+    auto sa = sextOf(a, w), sb = sextOf(b, w);
+    bool r;
+    switch (pred) {
+    case CmpInst::ICMP_EQ:  r = a == b; break;
+    case CmpInst::ICMP_NE:  r = a != b; break;
+    case CmpInst::ICMP_UGT: r = a > b; break;
+    case CmpInst::ICMP_UGE: r = a >= b; break;
+    case CmpInst::ICMP_ULT: r = a < b; break;
+    case CmpInst::ICMP_ULE: r = a <= b; break;
+    case CmpInst::ICMP_SGT: r = sa > sb; break;
+    case CmpInst::ICMP_SGE: r = sa >= sb; break;
+    case CmpInst::ICMP_SLT: r = sa < sb; break;
+    case CmpInst::ICMP_SLE: r = sa <= sb; break;
+    default:
+      LV.known = false;
+      return;
+    }
+    LV.v[l] = r;
+  }
+}
+
+// The incoming value of the edge each lane took. PathConstraint leaves a PHI
+// free on back edges and for undef incoming values, so those lanes keep a
+// sampled value.
+void ConcreteEvaluator::evalPHI(PHINode *PN, LaneValues &LV) {
+  sample(PN, LV);
+  auto *Ty = PN->getType();
+  if (!Ty->isIntegerTy() && !Ty->isPointerTy())
+    return;
+
+  auto *BB = PN->getParent();
+  for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+    auto *V = PN->getIncomingValue(i);
+    auto *Pred = PN->getIncomingBlock(i);
+    if (isa<UndefValue>(V) || backEdgesSet.count(std::make_pair(Pred, BB)))
+      continue;
+
+    auto edge = reachEdge(Pred, BB);
+    if (!edge.known) {
+      LV.known = false;
+      return;
+    }
+    if (!edge.reached)
+      continue;
+
+    auto &In = eval(V);
+    if (!In.known) {
+      LV.known = false;
+      return;
+    }
+    for (unsigned l = 0; l < Lanes; ++l) {
+      if (edge.reached & (1ULL << l))
+        LV.v[l] = In.v[l];
+    }
+  }
+}
+
+void ConcreteEvaluator::sample(Value *V, LaneValues &LV) {
+  auto w = LV.width;
+  auto m = maskOf(w);
+  auto smin = 1ULL << (w - 1);
+  uint64_t boundary[] = {
+    0, 1, 2, m, m - 1, smin, smin - 1, smin + 1,
+    1ULL << (w / 2), (1ULL << (w / 2)) - 1, 1ULL << (w - 2 + (w < 2)), 0xff, 0x7f, 0x80,
+  };
+  const unsigned nb = sizeof(boundary) / sizeof(boundary[0]);
+  auto leaf = leaves.size();
+  leaves.emplace_back(V, &LV);
+
+  for (unsigned l = 0; l < Lanes; ++l) {
+    auto r = splitmix64((static_cast<uint64_t>(batch) << 40) ^
+                        (static_cast<uint64_t>(leaf) << 8) ^ l);
+    uint64_t v;
+    switch (batch ? r % 4 : 0) {
+    case 0:
+      v = boundary[(r >> 2) % nb];
+      break;
+    case 1:
+      v = splitmix64(r);
+      break;
+    case 2: // small, of either sign
+      v = (r >> 2) % 256;
+      v = (r >> 12) & 1 ? 0 - v : v;
+      break;
+    default: // near a power of two
+      v = (1ULL << ((r >> 2) % w)) + (r >> 12) % 5 - 2;
+      break;
+    }
+    LV.v[l] = v & m;
+  }
+
+  auto it = pins.find(V);
+  if (it != pins.end()) {
+    for (auto &P: it->second)
+      LV.v[P.first] = P.second & m;
+  }
+
+  const FunctionFacts *facts = nullptr;
+  if (index) {
+    auto *A = dyn_cast<Argument>(V);
+    auto *CI = dyn_cast<CallInst>(V);
+    auto *Fn = A ? A->getParent() : CI ? CI->getCalledFunction() : nullptr;
+    if (Fn && !Fn->hasLocalLinkage())
+      facts = index->lookup(Fn->getName());
+    if (facts && A && facts->knowsArgs() && A->getArgNo() < facts->args.size())
+      clampTo(LV, facts->args[A->getArgNo()]);
+    else if (facts && CI)
+      clampTo(LV, facts->ret);
+  }
+}
+
+// Same clamping as ValueConstraint::clampToRange()
+void ConcreteEvaluator::clampTo(LaneValues &LV, const ConstantRange &CR) {
+  if (CR.isFullSet() || CR.isEmptySet() || CR.getBitWidth() != LV.width)
+    return;
+
+  auto m = maskOf(LV.width);
+  auto lo = CR.getLower().getZExtValue();
+  auto size = (CR.getUpper() - CR.getLower()).getZExtValue();
+  for (unsigned l = 0; l < Lanes; ++l) {
+    if (((LV.v[l] - lo) & m) >= size)
+      LV.v[l] = lo;
+  }
+}
+
+// Calls that ValueConstraint encodes as a free variable
+bool ConcreteEvaluator::isOpaqueCall(CallInst *CI) {
+  auto *Fn = CI->getCalledFunction();
+  return !Fn || !summaries || !summaryDepth || !summaries->isUsable(Fn);
+}
+
+ConcreteEvaluator::BlockLanes ConcreteEvaluator::reach(BasicBlock *BB) {
+  auto it = blocks.find(BB);
+  if (it != blocks.end())
+    return it->second;
+
+  BlockLanes R;
+  if (BB->isEntryBlock()) {
+    R.reached = ~0ULL;
+  } else {
+    for (auto *Pred: predecessors(BB)) {
+      if (backEdgesSet.count(std::make_pair(Pred, BB)))
+        continue;
+      auto edge = reachEdge(Pred, BB);
+      R.known &= edge.known;
+      R.reached |= edge.reached;
+    }
+  }
+  return blocks[BB] = R;
+}
+
+ConcreteEvaluator::BlockLanes ConcreteEvaluator::reachEdge(BasicBlock *Pred, BasicBlock *BB) {
+  std::pair<const BasicBlock *, const BasicBlock *> key(Pred, BB);
+  auto it = edges.find(key);
+  if (it != edges.end())
+    return it->second;
+
+  BlockLanes R = reach(Pred);
+  auto *T = Pred->getTerminator();
+
+  if (!R.known) {
+    // nothing to add
+  } else if (auto *BI = dyn_cast<BranchInst>(T)) {
+    if (BI->isConditional()) {
+      auto &C = eval(BI->getCondition());
+      LaneMask taken = 0;
+      for (unsigned l = 0; l < Lanes && C.known; ++l) {
+        auto succ = BI->getSuccessor((C.v[l] & 1) ? 0 : 1);
+        taken |= static_cast<LaneMask>(succ == BB) << l;
+      }
+      R.known = C.known;
+      R.reached &= taken;
+    }
+  } else if (auto *SI = dyn_cast<SwitchInst>(T)) {
+    auto &C = eval(SI->getCondition());
+    LaneMask taken = 0;
+    for (unsigned l = 0; l < Lanes && C.known; ++l) {
+      auto *succ = SI->getDefaultDest();
+      for (auto Case: SI->cases()) {
+        if (Case.getCaseValue()->getZExtValue() == C.v[l]) {
+          succ = Case.getCaseSuccessor();
+          break;
+        }
+      }
+      taken |= static_cast<LaneMask>(succ == BB) << l;
+    }
+    R.known = C.known;
+    R.reached &= taken;
+  } else {
+    // indirectbr and invoke may go anywhere
+    R.known = false;
+  }
+
+  return edges[key] = R;
+}
+
+ConcreteEvaluator::LaneMask ConcreteEvaluator::evalCheck(CallInst *CI, KINT_TYPE type) {
+  auto R = reach(CI->getParent());
+  if (!R.known || !R.reached)
+    return 0;
+
+  LaneMask fails = 0;
+  if (type == KINT_SHIFT_DIV) {
+    auto &C = eval(CI->getArgOperand(0));
+    if (!C.known)
+      return 0;
+    for (unsigned l = 0; l < Lanes; ++l)
+      fails |= static_cast<LaneMask>(C.v[l] & 1) << l;
+    return R.reached & fails;
+  }
+
+  auto opcode = cast<ConstantInt>(CI->getArgOperand(0))->getZExtValue();
+  auto nsw = !cast<ConstantInt>(CI->getArgOperand(3))->isZero();
+  auto &A = eval(CI->getArgOperand(1));
+  auto &B = eval(CI->getArgOperand(2));
+  if (!A.known || !B.known)
+    return 0;
+
+  auto w = A.width;
+  __int128 smin = -(static_cast<__int128>(1) << (w - 1));
+  __int128 smax = (static_cast<__int128>(1) << (w - 1)) - 1;
+  unsigned __int128 umax = maskOf(w);
+
+  for (unsigned l = 0; l < Lanes; ++l) {
+    bool overflow;
+    if (nsw) {
+      __int128 a = sextOf(A.v[l], w), b = sextOf(B.v[l], w), r;
+      switch (opcode) {
+      case Instruction::Add: r = a + b; break;
+      case Instruction::Sub: r = a - b; break;
+      case Instruction::Mul: r = a * b; break;
+      default: return 0;
+      }
+      overflow = r < smin || r > smax;
+    } else {
+      unsigned __int128 a = A.v[l], b = B.v[l];
+      switch (opcode) {
+      case Instruction::Add: overflow = a + b > umax; break;
+      case Instruction::Sub: overflow = a < b; break;
+      case Instruction::Mul: overflow = a * b > umax; break;
+      default: return 0;
+      }
+    }
+    fails |= static_cast<LaneMask>(overflow) << l;
+  }
+  return R.reached & fails;
+}
+
+void ConcreteEvaluator::getArgWitness(unsigned lane,
+    SmallVectorImpl<std::pair<std::string, std::string>> &witness) {
+  for (auto &A: F.args()) {
+    auto it = values.find(&A);
+    if (it == values.end() || !it->second->known)
+      continue;
+    auto &LV = *it->second;
+    auto name = A.hasName() ? A.getName().str() : "arg" + std::to_string(A.getArgNo());
+    APInt val(LV.width, LV.v[lane]);
+    witness.emplace_back(name, toString(val, 10, LV.width > 1));
+  }
+}
+
+void ConcreteEvaluator::getLeafValues(unsigned lane,
+    SmallVectorImpl<std::pair<const Value *, uint64_t>> &values) {
+  for (auto &L: leaves) {
+    if (L.second->known)
+      values.emplace_back(L.first, L.second->v[lane]);
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef CONCRETEEVAL_H
+#define CONCRETEEVAL_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <string>
+#include <utility>
+#include "Constraints.h"
+#include "KintChecks.h"
+#include "SummaryIndex.h"
+
+// Evaluates the queries of a function on concrete inputs, 64 assignments
+// (lanes) at a time, following the same encoding as ValueConstraint and
+// PathConstraint. A lane that reaches a check and violates it is a genuine
+// model of the query, so the check can be reported without the solver.
+// Anything the evaluator does not model exactly is unknown, and checks
+// depending on it are left to the solver.
+class ConcreteEvaluator {
+public:
+  static const unsigned Lanes = 64;
+  typedef uint64_t LaneMask;
+
+private:
+  struct LaneValues {
+    bool known = true;
+    unsigned width = 0;
+    uint64_t v[Lanes];
+  };
+
+  struct BlockLanes {
+    bool known = true;
+    LaneMask reached = 0;
+  };
+
+  llvm::Function &F;
+  const llvm::DataLayout &DL;
+  const std::set<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> backEdgesSet;
+
+  SummaryCache *summaries = nullptr;
+  unsigned summaryDepth = 0;
+  const SummaryIndex *index = nullptr;
+
+  unsigned batch = 0;
+  // Reset by every batch; a deque keeps references stable while it grows
+  std::deque<LaneValues> storage;
+  llvm::DenseMap<const llvm::Value *, LaneValues *> values;
+  llvm::DenseMap<const llvm::BasicBlock *, BlockLanes> blocks;
+  llvm::DenseMap<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, BlockLanes> edges;
+  // Leaves sampled so far, each gets its own stream of values
+  llvm::SmallVector<std::pair<const llvm::Value *, const LaneValues *>, 16> leaves;
+  // Values fixed by pin() in some lanes of the current batch
+  llvm::DenseMap<const llvm::Value *, llvm::SmallVector<std::pair<unsigned, uint64_t>, 4>> pins;
+
+  const LaneValues &eval(llvm::Value *);
+  LaneValues &alloc(unsigned width);
+  LaneValues &unknown();
+  void evalInst(llvm::Instruction *, LaneValues &);
+  void evalBinOp(llvm::BinaryOperator *, LaneValues &);
+  void evalICmp(llvm::ICmpInst *, LaneValues &);
+  void evalPHI(llvm::PHINode *, LaneValues &);
+  void sample(llvm::Value *, LaneValues &);
+  void clampTo(LaneValues &, const llvm::ConstantRange &);
+  BlockLanes reach(llvm::BasicBlock *);
+  BlockLanes reachEdge(llvm::BasicBlock *Pred, llvm::BasicBlock *BB);
+  bool isOpaqueCall(llvm::CallInst *);
+
+public:
+  ConcreteEvaluator(llvm::Function &F, const llvm::DataLayout &DL,
+    llvm::ArrayRef<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> BE) :
+    F(F), DL(DL), backEdgesSet(BE.begin(), BE.end()) {}
+
+  // Must match the ValueConstraint the solver would use, so that call
+  // results and arguments are only sampled where it leaves them free.
+  void setSummaries(SummaryCache *cache, unsigned depth) {
+    summaries = cache;
+    summaryDepth = depth;
+  }
+  void setSummaryIndex(const SummaryIndex *idx) { index = idx; }
+
+  // Draw fresh inputs. Batch 0 combines boundary values (0, 1, -1, the
+  // signed extremes, powers of two), later ones mix them with random bits.
+  void startBatch(unsigned batch);
+  // Use value for the leaf V in lane, instead of sampling it. Only valid
+  // before anything is evaluated in the current batch.
+  void pin(unsigned lane, const llvm::Value *V, uint64_t value) {
+    pins[V].emplace_back(lane, value);
+  }
+  // Lanes of the current batch in which control reaches CI and the check
+  // fails
+  LaneMask evalCheck(llvm::CallInst *CI, KINT_TYPE);
+  // (name, value) of the arguments sampled so far, in lane
+  void getArgWitness(unsigned lane,
+                     llvm::SmallVectorImpl<std::pair<std::string, std::string>> &);
+  // Values of the leaves sampled so far, in lane
+  void getLeafValues(unsigned lane,
+                     llvm::SmallVectorImpl<std::pair<const llvm::Value *, uint64_t>> &);
+};
+
+#endif /* CONCRETEEVAL_H */
@@ -1,25 +1,122 @@
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/Analysis/CFG.h>
+#include <llvm/IR/Function.h>
 #include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
+#include <algorithm>
 #include "Constraints.h"
 
+#define DEBUG_TYPE "kint"
+
 using namespace llvm;
 
+STATISTIC(NumAbstracted, "Number of nonlinear terms abstracted");
+STATISTIC(NumRefined,    "Number of abstracted terms refined to their exact encoding");
+STATISTIC(NumSummarized, "Number of call results encoded from a callee summary");
+STATISTIC(NumSummaries,  "Number of function summaries computed");
+STATISTIC(NumSwitchCases,  "Number of switch cases encoded");
+STATISTIC(NumSwitchRanges, "Number of runs of switch cases encoded as a range");
+
+void SummaryCache::reset(unsigned maxInsts) {
+  summaries.clear();
+  usable.clear();
+  // Drops the terms of the previous module
+  arena = std::make_shared<SMTTermArena>();
+  this->maxInsts = maxInsts;
+}
+
+bool SummaryCache::isUsable(const Function *F) {
+  auto it = usable.find(F);
+  if (it != usable.end())
+    return it->second;
+
+  bool result = false;
+  // A definition that may be replaced at link time tells us nothing.
+  if (!F->isDeclaration() && F->isDefinitionExact() && !F->isVarArg() &&
+      F->getInstructionCount() <= maxInsts) {
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 4> backEdges;
+    FindFunctionBackedges(*F, backEdges);
+    result = backEdges.empty() && any_of(*F, [](const BasicBlock &BB) {
+      return isa<ReturnInst>(BB.getTerminator());
+    });
+  }
+  return usable[F] = result;
+}
+
+const FunctionSummary &SummaryCache::get(Function *F, unsigned depth, const SummaryIndex *index) {
+  assert(isUsable(F) && depth && "no summary");
+  auto key = std::make_pair(F, depth);
+  auto it = summaries.find(key);
+  if (it != summaries.end())
+    return it->second;
+
+  SMTConfig config;
+  SMTSolver solver(config, arena);
+  ValueConstraint VC(solver, F->getParent()->getDataLayout());
+  VC.summaries = this;
+  VC.summaryDepth = depth - 1;
+  VC.index = index;
+  PathConstraint Paths(VC, None);
+  VC.phiPaths = &Paths;
+
+  FunctionSummary S;
+  for (auto &A: F->args()) {
+    SMTExpr param = nullptr;
+    if (ValueConstraint::isAnalyzable(A.getType())) {
+      std::string name;
+      raw_string_ostream oss(name);
+      oss << A;
+      param = solver.smt_var(VC.DL.getTypeSizeInBits(A.getType()), oss.str());
+      VC.valueToExpr[&A] = param;
+    }
+    S.params.push_back(param);
+  }
+
+  // Free if the call does not return
+  S.ret = solver.smt_var(VC.DL.getTypeSizeInBits(F->getReturnType()), "ret");
+  for (auto &BB: reverse(*F)) {
+    auto *RI = dyn_cast<ReturnInst>(BB.getTerminator());
+    if (!RI)
+      continue;
+    auto pcExpr = Paths.calcConstraint(&BB);
+    auto valExpr = VC.calcConstraint(RI->getReturnValue());
+    S.ret = solver.smt_cond(pcExpr, valExpr, S.ret);
+  }
+
+  ++NumSummaries;
+  return summaries[key] = std::move(S);
+}
+
+SMTExpr SummaryCache::instantiate(const FunctionSummary &S, ArrayRef<SMTExpr> args,
+                                  SMTSolver &solver, StringRef prefix) {
+  DenseMap<SMTExpr, SMTExpr> vars;
+  for (unsigned i = 0; i < S.params.size(); ++i) {
+    if (S.params[i])
+      vars[S.params[i]] = args[i];
+  }
+  return copyTerm(solver.getArena(), S.ret, [&](SMTExpr var) {
+    auto &copy = vars[var];
+    if (!copy)
+      copy = solver.smt_var(var->width, (prefix + var->name).str());
+    return copy;
+  });
+}
+
 SMTExpr PathConstraint::calcConstraint(Instruction *I) {
   return calcConstraint(I->getParent());
 }
 
 SMTExpr PathConstraint::calcConstraint(BasicBlock *BB) {
   auto expr = BBToExpr.lookup(BB);
-  if (expr) {
-    solver.smt_copy(expr);
+  if (expr)
     return expr;
-  }
 
   if (BB->isEntryBlock()) {
     expr = solver.smt_true();
-    solver.smt_copy(expr);
     BBToExpr[BB] = expr;
     return expr;
   }
@@ -28,31 +125,38 @@ SMTExpr PathConstraint::calcConstraint(BasicBlock *BB) {
 
   for(auto it = pred_begin(BB), eit = pred_end(BB); it != eit; ++it) {
     if (backEdgesSet.find(std::make_pair(*it, BB)) == backEdgesSet.end()) {
-      // assume BB to be well-formed, i.e. predBr is not null
-      auto predBr = (*it)->getTerminator();
-      auto brExpr = calcBrConstraint(predBr, BB);
-      auto assignExpr = calcAssignConstraint(BB, *it);
-      auto andExpr = solver.smt_and(brExpr, assignExpr);
-      solver.smt_release(brExpr);
-      solver.smt_release(assignExpr);
-      auto predExpr = calcConstraint(*it);
-      auto andExpr2 = solver.smt_and(andExpr, predExpr);
-      solver.smt_release(andExpr);
-      solver.smt_release(predExpr);
-      auto newExpr = solver.smt_or(andExpr2, expr);
-      solver.smt_release(andExpr2);
-      solver.smt_release(expr);
-      expr = newExpr;
+      auto edgeExpr = calcEdgeConstraint(*it, BB);
+      expr = solver.smt_or(edgeExpr, expr);
     }
   }
 
-  solver.smt_copy(expr);
   BBToExpr[BB] = expr;
   return expr;
 }
 
+// Control reaches BB through the edge from Pred
+SMTExpr PathConstraint::calcEdgeConstraint(BasicBlock *Pred, BasicBlock *BB) {
+  // assume BB to be well-formed, i.e. predBr is not null
+  auto predBr = Pred->getTerminator();
+  auto brExpr = calcBrConstraint(predBr, BB);
+  auto assignExpr = calcAssignConstraint(BB, Pred);
+  auto andExpr = solver.smt_and(brExpr, assignExpr);
+  auto predExpr = calcConstraint(Pred);
+  return solver.smt_and(andExpr, predExpr);
+}
+
 SMTExpr PathConstraint::calcAssignConstraint(BasicBlock *BB, BasicBlock *Pred) {
   auto expr = solver.smt_true();
+
+  // PHIs already are selects over their incoming edges.
+  if (ValCon.phiPaths == this)
+    return expr;
+
+  // Only the entry edge of a loop header is encoded, so pinning its PHIs to
+  // the incoming value would describe the first iteration only.
+  if (havocLoopPhis && loopHeaders.count(BB))
+    return expr;
+
   for (auto &I: *BB) {
     if (auto *PN = dyn_cast<PHINode>(&I)) {
       Value *V = PN->getIncomingValueForBlock(Pred);
@@ -61,12 +165,7 @@ SMTExpr PathConstraint::calcAssignConstraint(BasicBlock *BB, BasicBlock *Pred) {
       auto incomingExpr = ValCon.calcConstraint(V);
       auto phiExpr = ValCon.calcConstraint(PN);
       auto eqExpr = solver.smt_eq(incomingExpr, phiExpr);
-      solver.smt_release(incomingExpr);
-      solver.smt_release(phiExpr);
-      auto newExpr = solver.smt_and(expr, eqExpr);
-      solver.smt_release(expr);
-      solver.smt_release(eqExpr);
-      expr = newExpr;
+      expr = solver.smt_and(expr, eqExpr);
     }
   }
   return expr;
@@ -80,44 +179,24 @@ SMTExpr PathConstraint::calcBrConstraint(Instruction *I, BasicBlock *BB) {
     auto expr = ValCon.calcConstraint(BI->getCondition());
 
     // Check BB path
-    if (BI->getSuccessor(0) != BB) {
-      auto newExpr = solver.smt_neg(expr);
-      solver.smt_release(expr);
-      expr = newExpr;
-    }
+    if (BI->getSuccessor(0) != BB)
+      expr = solver.smt_not(expr);
     return expr;
 
   } else if (auto *SI = dyn_cast<SwitchInst>(I)) {
-    auto condExpr = ValCon.calcConstraint(SI->getCondition());
+    auto &SR = getSwitchRanges(SI);
     auto expr = solver.smt_false();
-    for (auto C: SI->cases()) {
-      // This case goes to our BB
-      if (C.getCaseSuccessor() == BB) {
-        auto caseExpr = ValCon.calcConstraint(C.getCaseValue());
-        auto eqExpr = solver.smt_eq(condExpr, caseExpr);
-        solver.smt_release(caseExpr);
-        auto newExpr = solver.smt_or(expr, eqExpr);
-        solver.smt_release(eqExpr);
-        solver.smt_release(expr);
-        expr = newExpr;
+    auto it = SR.cases.find(BB);
+    if (it != SR.cases.end()) {
+      for (auto &R: it->second) {
+        auto rangeExpr = calcRangeConstraint(SR.cond, R);
+        expr = solver.smt_or(expr, rangeExpr);
       }
     }
 
     if (SI->getDefaultDest() == BB) {
-      auto defaultExpr = solver.smt_true();
-      for (auto C: SI->cases()) {
-        auto caseExpr = ValCon.calcConstraint(C.getCaseValue());
-        auto neExpr = solver.smt_ne(condExpr, caseExpr);
-        solver.smt_release(caseExpr);
-        auto newExpr = solver.smt_and(defaultExpr, neExpr);
-        solver.smt_release(neExpr);
-        solver.smt_release(defaultExpr);
-        defaultExpr = newExpr;
-      }
-      auto newExpr = solver.smt_or(defaultExpr, expr);
-      solver.smt_release(expr);
-      solver.smt_release(defaultExpr);
-      expr = newExpr;
+      auto defaultExpr = solver.smt_not(SR.anyCase);
+      expr = solver.smt_or(defaultExpr, expr);
     }
     return expr;
 
@@ -130,21 +209,82 @@ SMTExpr PathConstraint::calcBrConstraint(Instruction *I, BasicBlock *BB) {
   llvm_unreachable("Invalid terminating inst");
 }
 
+// lo <= cond <= hi, unsigned
+SMTExpr PathConstraint::calcRangeConstraint(SMTExpr cond, const SwitchRanges::Range &R) {
+  auto loExpr = solver.smt_const(R.first);
+  if (R.first == R.second) {
+    auto expr = solver.smt_eq(cond, loExpr);
+    return expr;
+  }
+
+  auto hiExpr = solver.smt_const(R.second);
+  auto geExpr = solver.smt_uge(cond, loExpr);
+  auto leExpr = solver.smt_ule(cond, hiExpr);
+  auto expr = solver.smt_and(geExpr, leExpr);
+  ++NumSwitchRanges;
+  return expr;
+}
+
+const PathConstraint::SwitchRanges &PathConstraint::getSwitchRanges(SwitchInst *SI) {
+  auto it = switchRanges.find(SI);
+  if (it != switchRanges.end())
+    return it->second;
+
+  SmallVector<std::pair<APInt, const BasicBlock *>, 16> values;
+  for (auto C: SI->cases())
+    values.emplace_back(C.getCaseValue()->getValue(), C.getCaseSuccessor());
+  std::sort(values.begin(), values.end(),
+            [](const std::pair<APInt, const BasicBlock *> &A,
+               const std::pair<APInt, const BasicBlock *> &B) {
+              return A.first.ult(B.first);
+            });
+
+  // Case values are distinct, so sorted ones are consecutive exactly when
+  // they differ by one.
+  SwitchRanges SR;
+  SmallVector<SwitchRanges::Range, 4> covered;
+  for (size_t i = 0; i < values.size(); ++i) {
+    auto &V = values[i].first;
+    auto *Dest = values[i].second;
+    bool follows = i && V == values[i - 1].first + 1;
+
+    auto &destRanges = SR.cases[Dest];
+    if (follows && values[i - 1].second == Dest)
+      destRanges.back().second = V;
+    else
+      destRanges.emplace_back(V, V);
+
+    if (follows)
+      covered.back().second = V;
+    else
+      covered.emplace_back(V, V);
+  }
+  NumSwitchCases += values.size();
+
+  SR.cond = ValCon.calcConstraint(SI->getCondition());
+  SR.anyCase = solver.smt_false();
+  for (auto &R: covered) {
+    auto rangeExpr = calcRangeConstraint(SR.cond, R);
+    SR.anyCase = solver.smt_or(SR.anyCase, rangeExpr);
+  }
+
+  return switchRanges[SI] = std::move(SR);
+}
+
 SMTExpr ValueConstraint::calcConstraint(llvm::Value *V) {
   auto expr = valueToExpr.lookup(V);
-  if (expr) {
-    solver.smt_copy(expr);
+  if (expr)
     return expr;
-  }
 
   if (auto I = dyn_cast<Instruction>(V))
     expr = calcInstConstraint(I);
   else if (auto C = dyn_cast<Constant>(V))
     expr = calcConstConstraint(C);
+  else if (auto A = dyn_cast<Argument>(V))
+    expr = calcArgConstraint(A);
   else
     expr = varConstraint(V);
 
-  solver.smt_copy(expr);
   valueToExpr[V] = expr;
 
   return expr;
@@ -173,6 +313,16 @@ SMTExpr ValueConstraint::calcInstConstraint(llvm::Instruction *I) {
     return calcIntToPtrConstraint(ITPI);
   else if (auto PTII = dyn_cast<PtrToIntInst>(I))
     return calcPtrToIntConstraint(PTII);
+  else if (isa<PHINode>(I) && phiPaths)
+    return calcPHIConstraint(cast<PHINode>(I));
+  else if (auto EEI = dyn_cast<ExtractElementInst>(I))
+    return calcExtractElementConstraint(EEI);
+  else if (auto IEI = dyn_cast<InsertElementInst>(I))
+    return calcInsertElementConstraint(IEI);
+  else if (auto SVI = dyn_cast<ShuffleVectorInst>(I))
+    return calcShuffleVectorConstraint(SVI);
+  else if (auto CI = dyn_cast<CallInst>(I))
+    return calcCallConstraint(CI);
   else
     return varConstraint(I);
 }
@@ -184,23 +334,75 @@ SMTExpr ValueConstraint::calcConstConstraint(llvm::Constant *C) {
     return solver.smt_const(APInt::getNullValue(DL.getPointerSizeInBits()));
   else if(auto GEPO = dyn_cast<GEPOperator>(C))
     return calcGEPOConstraint(GEPO);
+  else if (auto VTy = dyn_cast<FixedVectorType>(C->getType()))
+    return calcVectorConstConstraint(C, VTy);
   else
     return varConstraint(C);
 }
 
+// Lane by lane, unless some lane is not a plain integer or pointer
+SMTExpr ValueConstraint::calcVectorConstConstraint(Constant *C, FixedVectorType *VTy) {
+  if (isa<UndefValue>(C) || !isAnalyzable(VTy))
+    return varConstraint(C);
+
+  auto numLanes = VTy->getNumElements();
+  auto laneWidth = DL.getTypeSizeInBits(VTy->getElementType());
+  APInt value(numLanes * laneWidth, 0);
+  SmallVector<Constant *, 8> elems;
+  bool allInts = true;
+  for (unsigned i = 0; i < numLanes; ++i) {
+    auto *E = C->getAggregateElement(i);
+    if (!E)
+      return varConstraint(C);
+    if (auto *CI = dyn_cast<ConstantInt>(E))
+      value.insertBits(CI->getValue(), i * laneWidth);
+    else
+      allInts = false;
+    elems.push_back(E);
+  }
+  if (allInts)
+    return solver.smt_const(value);
+
+  SmallVector<SMTExpr, 8> lanes;
+  for (auto *E: elems)
+    lanes.push_back(calcConstraint(E));
+  return concatLanes(lanes);
+}
+
 SMTExpr ValueConstraint::varConstraint(Value *V) {
   std::string name;
   raw_string_ostream oss(name);
-  oss << *V;
-  return solver.smt_var(DL.getTypeSizeInBits(V->getType()), oss.str());
+  oss << prefix << *V;
+  leaves.push_back(V);
+
+  auto width = DL.getTypeSizeInBits(V->getType());
+  if (!narrowWidth || width <= narrowWidth)
+    return solver.smt_var(width, oss.str());
+
+  auto var = solver.smt_var(narrowWidth, oss.str());
+  return solver.smt_sext(var, width - narrowWidth);
 }
 
 SMTExpr ValueConstraint::calcBinOpConstraint(BinaryOperator *BO) {
   auto e1 = calcConstraint(BO->getOperand(0));
   auto e2 = calcConstraint(BO->getOperand(1));
+  auto opcode = BO->getOpcode();
   SMTExpr expr;
 
-  switch (BO->getOpcode()) {
+  if (shouldAbstract(opcode, BO->getOperand(0), BO->getOperand(1)))
+    expr = abstractOp(opcode, false, false, e1, e2);
+  else
+    expr = mapLanes(getNumLanes(BO->getType()), { e1, e2 }, [&](ArrayRef<SMTExpr> ops) {
+      return calcBinOp(opcode, ops[0], ops[1]);
+    });
+
+  return expr;
+}
+
+SMTExpr ValueConstraint::calcBinOp(unsigned opcode, SMTExpr e1, SMTExpr e2) {
+  SMTExpr expr;
+
+  switch (opcode) {
   case Instruction::Add:
     expr = solver.smt_add(e1, e2);
     break;
@@ -243,18 +445,23 @@ SMTExpr ValueConstraint::calcBinOpConstraint(BinaryOperator *BO) {
   default:
     llvm_unreachable("Invalid binary operator");
   }
-
-  solver.smt_release(e1);
-  solver.smt_release(e2);
   return expr;
 }
 
 SMTExpr ValueConstraint::calcICmpConstraint(ICmpInst *ICI) {
   auto e1 = calcConstraint(ICI->getOperand(0));
   auto e2 = calcConstraint(ICI->getOperand(1));
+  auto pred = ICI->getPredicate();
+  auto expr = mapLanes(getNumLanes(ICI->getType()), { e1, e2 }, [&](ArrayRef<SMTExpr> ops) {
+    return calcICmp(pred, ops[0], ops[1]);
+  });
+  return expr;
+}
+
+SMTExpr ValueConstraint::calcICmp(CmpInst::Predicate pred, SMTExpr e1, SMTExpr e2) {
   SMTExpr expr;
 
-  switch(ICI->getPredicate()) {
+  switch(pred) {
   case CmpInst::ICMP_EQ:
     expr = solver.smt_eq(e1, e2);
     break;
@@ -288,9 +495,6 @@ SMTExpr ValueConstraint::calcICmpConstraint(ICmpInst *ICI) {
   default:
     llvm_unreachable("Invalid ICmp predicate");
   }
-
-  solver.smt_release(e1);
-  solver.smt_release(e2);
   return expr;
 }
 
@@ -300,21 +504,24 @@ SMTExpr ValueConstraint::calcGEPConstraint(GetElementPtrInst *GEPI) {
 
 
 SMTExpr ValueConstraint::calcGEPOConstraint(GEPOperator *GEPO) {
+  // Vectors of addresses are left free.
+  if (GEPO->getType()->isVectorTy())
+    return varConstraint(GEPO);
+
   auto base = calcConstraint(GEPO->getPointerOperand());
   auto ptrSize = DL.getPointerSizeInBits();
   auto ceOff = APInt::getNullValue(ptrSize);
 
-  errs() << *GEPO << "\n";
+  LLVM_DEBUG(dbgs() << *GEPO << "\n");
   auto it = gep_type_begin(GEPO);
   for (int i = 1; i < GEPO->getNumOperands(); i++) {
     Value *V = GEPO->getOperand(i);
-    errs() << *V << " " << *(it.getIndexedType()) << '\n';
+    LLVM_DEBUG(dbgs() << *V << " " << *(it.getIndexedType()) << '\n');
     if (ConstantInt *CI = dyn_cast<ConstantInt>(V)) {
       if (!CI->isZero()) {
         auto *ST = dyn_cast<StructType>(it.getIndexedType());
         if (i != 1 && ST) { // struct index
-          errs() << "struct" << '\n';
-          errs() << *ST << '\n';
+          LLVM_DEBUG(dbgs() << "struct" << '\n' << *ST << '\n');
           ceOff += DL.getStructLayout(ST)->getElementOffset(CI->getZExtValue());
         } else { // array index
           Type *ET;
@@ -325,7 +532,7 @@ SMTExpr ValueConstraint::calcGEPOConstraint(GEPOperator *GEPO) {
             assert(AU);
             ET = AU->getElementType();
           }
-          errs() << "array" << '\n';
+          LLVM_DEBUG(dbgs() << "array" << '\n');
           auto elemSize = APInt(ptrSize, DL.getTypeAllocSize(ET));
           ceOff += elemSize * CI->getValue().sextOrTrunc(ptrSize);
         }
@@ -343,22 +550,16 @@ SMTExpr ValueConstraint::calcGEPOConstraint(GEPOperator *GEPO) {
       // Sometimes a 64-bit GEP's index is 32-bit.
       // Reference: https://github.com/CRYPTOlab/kint/blob/c3402fa03ff76657045ca564a96176e356fa0e7a/src/ValueGen.cc#L198
       if (idxSize != ptrSize) {
-        errs() << "calcGEPConstraint: diff size\n";
+        LLVM_DEBUG(dbgs() << "calcGEPConstraint: diff size\n");
         SMTExpr Tmp;
         if (idxSize < ptrSize)
           Tmp = solver.smt_sext(idxExpr, ptrSize - idxSize);
         else
           Tmp = solver.smt_slice(idxExpr, ptrSize - 1, 0);
-        solver.smt_release(idxExpr);
         idxExpr = Tmp;
       }
       auto varOffExpr = solver.smt_mul(idxExpr, elemSizeExpr);
-      solver.smt_release(idxExpr);
-      solver.smt_release(elemSizeExpr);
-      auto newbase = solver.smt_add(base, varOffExpr);
-      solver.smt_release(base);
-      solver.smt_release(varOffExpr);
-      base = newbase;
+      base = solver.smt_add(base, varOffExpr);
     }
 
     // Increment iterator
@@ -367,56 +568,58 @@ SMTExpr ValueConstraint::calcGEPOConstraint(GEPOperator *GEPO) {
     }
   }
 
-  errs() << ceOff << '\n';
+  LLVM_DEBUG(dbgs() << ceOff << '\n');
   if (!ceOff)
     return base;
 
   auto ceOffExpr = solver.smt_const(ceOff);
-  auto newBase = solver.smt_add(base, ceOffExpr);
-  solver.smt_release(base);
-  base = newBase;
-  return base;
+  return solver.smt_add(base, ceOffExpr);
 }
 
+// Casts of vectors apply lane by lane, with the widths of the lanes.
 SMTExpr ValueConstraint::calcTruncConstraint(TruncInst *TI) {
-  auto width = DL.getTypeSizeInBits(TI->getDestTy());
+  auto width = DL.getTypeSizeInBits(TI->getDestTy()->getScalarType());
   auto e = calcConstraint(TI->getOperand(0));
-  auto expr = solver.smt_slice(e, width - 1, 0);
-  solver.smt_release(e);
+  auto expr = mapLanes(getNumLanes(TI->getType()), e, [&](ArrayRef<SMTExpr> ops) {
+    return solver.smt_slice(ops[0], width - 1, 0);
+  });
   return expr;
 }
 
 SMTExpr ValueConstraint::calcZExtConstraint(ZExtInst *ZEI) {
-  auto DWidth = DL.getTypeSizeInBits(ZEI->getDestTy());
-  auto SWidth = DL.getTypeSizeInBits(ZEI->getSrcTy());
+  auto DWidth = DL.getTypeSizeInBits(ZEI->getDestTy()->getScalarType());
+  auto SWidth = DL.getTypeSizeInBits(ZEI->getSrcTy()->getScalarType());
   auto e = calcConstraint(ZEI->getOperand(0));
-  auto expr = solver.smt_zext(e, DWidth - SWidth);
-  solver.smt_release(e);
+  auto expr = mapLanes(getNumLanes(ZEI->getType()), e, [&](ArrayRef<SMTExpr> ops) {
+    return solver.smt_zext(ops[0], DWidth - SWidth);
+  });
   return expr;
 }
 
 SMTExpr ValueConstraint::calcSExtConstraint(SExtInst *SEI) {
-  auto DWidth = DL.getTypeSizeInBits(SEI->getDestTy());
-  auto SWidth = DL.getTypeSizeInBits(SEI->getSrcTy());
+  auto DWidth = DL.getTypeSizeInBits(SEI->getDestTy()->getScalarType());
+  auto SWidth = DL.getTypeSizeInBits(SEI->getSrcTy()->getScalarType());
   auto e = calcConstraint(SEI->getOperand(0));
-  auto expr = solver.smt_sext(e, DWidth - SWidth);
-  solver.smt_release(e);
+  auto expr = mapLanes(getNumLanes(SEI->getType()), e, [&](ArrayRef<SMTExpr> ops) {
+    return solver.smt_sext(ops[0], DWidth - SWidth);
+  });
   return expr;
 }
 
+// A vector condition selects lane by lane.
 SMTExpr ValueConstraint::calcSelectConstraint(SelectInst *SI) {
   auto condExpr = calcConstraint(SI->getCondition());
   auto trueExpr = calcConstraint(SI->getTrueValue());
   auto falseExpr = calcConstraint(SI->getFalseValue());
-  auto expr = solver.smt_cond(condExpr, trueExpr, falseExpr);
-  solver.smt_release(condExpr);
-  solver.smt_release(trueExpr);
-  solver.smt_release(falseExpr);
+  auto expr = mapLanes(getNumLanes(SI->getCondition()->getType()), { condExpr, trueExpr, falseExpr },
+                       [&](ArrayRef<SMTExpr> ops) {
+    return solver.smt_cond(ops[0], ops[1], ops[2]);
+  });
   return expr;
 }
 
 SMTExpr ValueConstraint::CalcExtractValueConstraint(ExtractValueInst *EVI) {
-  errs() << "CalcExtractValueConstraint: " << *EVI << '\n';
+  LLVM_DEBUG(dbgs() << "CalcExtractValueConstraint: " << *EVI << '\n');
   return varConstraint(EVI);
 }
 
@@ -427,12 +630,16 @@ SMTExpr ValueConstraint::calcBitCastConstraint(BitCastInst *BCI) {
   if (!isAnalyzable(V->getType()))
     return varConstraint(BCI);
 
+  // Lanes are laid out as on a little-endian target.
+  if ((V->getType()->isVectorTy() || BCI->getType()->isVectorTy()) && DL.isBigEndian())
+    return varConstraint(BCI);
+
   return calcConstraint(V);
 }
 
 SMTExpr ValueConstraint::calcIntToPtrConstraint(IntToPtrInst *ITPI) {
-  auto DWidth = DL.getTypeSizeInBits(ITPI->getDestTy());
-  auto SWidth = DL.getTypeSizeInBits(ITPI->getSrcTy());
+  auto DWidth = DL.getTypeSizeInBits(ITPI->getDestTy()->getScalarType());
+  auto SWidth = DL.getTypeSizeInBits(ITPI->getSrcTy()->getScalarType());
   auto e = calcConstraint(ITPI->getOperand(0));
   SMTExpr expr;
 
@@ -441,15 +648,16 @@ SMTExpr ValueConstraint::calcIntToPtrConstraint(IntToPtrInst *ITPI) {
 
   assert(DWidth != SWidth);
 
-  expr = DWidth < SWidth ? solver.smt_slice(e, DWidth - 1, 0) :
-                           solver.smt_zext(e, DWidth - SWidth);
-  solver.smt_release(e);
+  expr = mapLanes(getNumLanes(ITPI->getType()), e, [&](ArrayRef<SMTExpr> ops) {
+    return DWidth < SWidth ? solver.smt_slice(ops[0], DWidth - 1, 0) :
+                             solver.smt_zext(ops[0], DWidth - SWidth);
+  });
   return expr;
 }
 
 SMTExpr ValueConstraint::calcPtrToIntConstraint(PtrToIntInst *PTII) {
-  auto DWidth = DL.getTypeSizeInBits(PTII->getDestTy());
-  auto SWidth = DL.getTypeSizeInBits(PTII->getSrcTy());
+  auto DWidth = DL.getTypeSizeInBits(PTII->getDestTy()->getScalarType());
+  auto SWidth = DL.getTypeSizeInBits(PTII->getSrcTy()->getScalarType());
   auto e = calcConstraint(PTII->getOperand(0));
   SMTExpr expr;
 
@@ -458,17 +666,43 @@ SMTExpr ValueConstraint::calcPtrToIntConstraint(PtrToIntInst *PTII) {
 
   assert(DWidth != SWidth);
 
-  expr = DWidth < SWidth ? solver.smt_slice(e, DWidth - 1, 0) :
-                           solver.smt_zext(e, DWidth - SWidth);
-  solver.smt_release(e);
+  expr = mapLanes(getNumLanes(PTII->getType()), e, [&](ArrayRef<SMTExpr> ops) {
+    return DWidth < SWidth ? solver.smt_slice(ops[0], DWidth - 1, 0) :
+                             solver.smt_zext(ops[0], DWidth - SWidth);
+  });
   return expr;
 }
 
 SMTExpr ValueConstraint::calcOverflowConstraint(CallInst *CI) {
   auto opcode = cast<ConstantInt>(CI->getArgOperand(0))->getZExtValue();
-  auto e1 = calcConstraint(CI->getArgOperand(1));
-  auto e2 = calcConstraint(CI->getArgOperand(2));
   auto nsw = static_cast<bool>(cast<ConstantInt>(CI->getArgOperand(3))->getZExtValue());
+  return calcOverflowConstraint(opcode, CI->getArgOperand(1), CI->getArgOperand(2), nsw);
+}
+
+SMTExpr ValueConstraint::calcOverflowConstraint(unsigned opcode, Value *V1, Value *V2, bool nsw) {
+  auto e1 = calcConstraint(V1);
+  auto e2 = calcConstraint(V2);
+  SMTExpr expr;
+
+  if (opcode == Instruction::Mul && shouldAbstract(opcode, V1, V2)) {
+    expr = abstractOp(opcode, true, nsw, e1, e2);
+    return expr;
+  }
+
+  // A vector operation overflows if any of its lanes does.
+  auto numLanes = getNumLanes(V1->getType());
+  expr = mapLanes(numLanes, { e1, e2 }, [&](ArrayRef<SMTExpr> ops) {
+    return calcOverflowOp(opcode, nsw, ops[0], ops[1]);
+  });
+  if (numLanes == 1)
+    return expr;
+
+  auto zero = solver.smt_const(APInt::getNullValue(numLanes));
+  auto anyExpr = solver.smt_ne(expr, zero);
+  return anyExpr;
+}
+
+SMTExpr ValueConstraint::calcOverflowOp(unsigned opcode, bool nsw, SMTExpr e1, SMTExpr e2) {
   SMTExpr expr;
 
   switch (opcode) {
@@ -484,10 +718,6 @@ SMTExpr ValueConstraint::calcOverflowConstraint(CallInst *CI) {
   default:
     llvm_unreachable("unsupported intop");
   }
-
-  solver.smt_release(e1);
-  solver.smt_release(e2);
-
   return expr;
 }
 
@@ -495,9 +725,401 @@ SMTExpr ValueConstraint::calcShiftDivConstraint(CallInst *CI) {
   return calcConstraint(CI->getArgOperand(0));
 }
 
+// Vectors are always encoded exactly, lane by lane.
+bool ValueConstraint::shouldAbstract(unsigned opcode, Value *V1, Value *V2) {
+  if (!abstractMinWidth || isa<Constant>(V1) || isa<Constant>(V2) ||
+      V1->getType()->isVectorTy())
+    return false;
+
+  switch (opcode) {
+  case Instruction::Mul:
+  case Instruction::UDiv:
+  case Instruction::SDiv:
+  case Instruction::URem:
+  case Instruction::SRem:
+    return DL.getTypeSizeInBits(V1->getType()) >= std::max(abstractMinWidth, 2u);
+  default:
+    return false;
+  }
+}
+
+SMTExpr ValueConstraint::abstractOp(unsigned opcode, bool isOverflow, bool isSigned,
+                                    SMTExpr e1, SMTExpr e2) {
+  auto abs = solver.smt_var(isOverflow ? 1 : solver.smt_get_width(e1));
+  abstractions.push_back({ opcode, isOverflow, isSigned, e1, e2, abs, false });
+  addLemma(calcLemmaConstraint(abstractions.back()));
+  ++NumAbstracted;
+  return abs;
+}
+
+SMTExpr ValueConstraint::calcExactConstraint(const Abstraction &A) {
+  if (A.isOverflow)
+    return A.isSigned ? solver.smt_smul_overflow(A.lhs, A.rhs) :
+                        solver.smt_umul_overflow(A.lhs, A.rhs);
+
+  switch (A.opcode) {
+  case Instruction::Mul:
+    return solver.smt_mul(A.lhs, A.rhs);
+  case Instruction::UDiv:
+    return solver.smt_udiv(A.lhs, A.rhs);
+  case Instruction::SDiv:
+    return solver.smt_sdiv(A.lhs, A.rhs);
+  case Instruction::URem:
+    return solver.smt_urem(A.lhs, A.rhs);
+  case Instruction::SRem:
+    return solver.smt_srem(A.lhs, A.rhs);
+  default:
+    llvm_unreachable("not an abstracted operator");
+  }
+}
+
+// Facts that hold for the exact operator but are much cheaper to bit-blast:
+// identities for 0 and 1, the low bit of a product, and the ranges of
+// quotients and remainders.
+SMTExpr ValueConstraint::calcLemmaConstraint(const Abstraction &A) {
+  auto width = solver.smt_get_width(A.lhs);
+  auto zero = solver.smt_const(APInt::getNullValue(width));
+  auto one = solver.smt_const(APInt(width, 1));
+  auto lhsZero = solver.smt_eq(A.lhs, zero);
+  auto rhsZero = solver.smt_eq(A.rhs, zero);
+  auto lhsOne = solver.smt_eq(A.lhs, one);
+  auto rhsOne = solver.smt_eq(A.rhs, one);
+  auto rhsNonZero = solver.smt_not(rhsZero);
+  SmallVector<SMTExpr, 4> facts;
+
+  if (A.isOverflow) {
+    // Nothing overflows when an operand is 0 or 1, or when both operands
+    // fit in half the width.
+    auto trivial = solver.smt_or(solver.smt_or(lhsZero, rhsZero),
+                                 solver.smt_or(lhsOne, rhsOne));
+    SMTExpr small;
+    if (A.isSigned) {
+      auto lo = solver.smt_const(APInt::getSignedMinValue(width / 2).sext(width));
+      auto hi = solver.smt_const(APInt::getSignedMaxValue(width / 2).sext(width));
+      auto lhsSmall = solver.smt_and(solver.smt_sge(A.lhs, lo),
+                                     solver.smt_sle(A.lhs, hi));
+      auto rhsSmall = solver.smt_and(solver.smt_sge(A.rhs, lo),
+                                     solver.smt_sle(A.rhs, hi));
+      small = solver.smt_and(lhsSmall, rhsSmall);
+    } else {
+      auto hi = solver.smt_const(APInt::getMaxValue(width / 2).zext(width));
+      small = solver.smt_and(solver.smt_ule(A.lhs, hi),
+                             solver.smt_ule(A.rhs, hi));
+    }
+    auto noOverflow = solver.smt_not(A.abs);
+    facts.push_back(solver.smt_implies(solver.smt_or(trivial, small), noOverflow));
+  } else {
+    switch (A.opcode) {
+    case Instruction::Mul: {
+      auto absZero = solver.smt_eq(A.abs, zero);
+      facts.push_back(solver.smt_implies(solver.smt_or(lhsZero, rhsZero), absZero));
+      facts.push_back(solver.smt_implies(lhsOne, solver.smt_eq(A.abs, A.rhs)));
+      facts.push_back(solver.smt_implies(rhsOne, solver.smt_eq(A.abs, A.lhs)));
+      auto lowBits = solver.smt_and(solver.smt_slice(A.lhs, 0, 0),
+                                    solver.smt_slice(A.rhs, 0, 0));
+      facts.push_back(solver.smt_eq(solver.smt_slice(A.abs, 0, 0), lowBits));
+      break;
+    }
+    case Instruction::UDiv: {
+      auto ones = solver.smt_const(APInt::getAllOnesValue(width));
+      facts.push_back(solver.smt_implies(rhsZero, solver.smt_eq(A.abs, ones)));
+      facts.push_back(solver.smt_implies(rhsNonZero, solver.smt_ule(A.abs, A.lhs)));
+      facts.push_back(solver.smt_implies(rhsOne, solver.smt_eq(A.abs, A.lhs)));
+      break;
+    }
+    case Instruction::URem: {
+      auto bounded = solver.smt_and(solver.smt_ult(A.abs, A.rhs),
+                                    solver.smt_ule(A.abs, A.lhs));
+      facts.push_back(solver.smt_implies(rhsZero, solver.smt_eq(A.abs, A.lhs)));
+      facts.push_back(solver.smt_implies(rhsNonZero, bounded));
+      break;
+    }
+    case Instruction::SDiv:
+      facts.push_back(solver.smt_implies(rhsOne, solver.smt_eq(A.abs, A.lhs)));
+      facts.push_back(solver.smt_implies(solver.smt_and(lhsZero, rhsNonZero),
+                                         solver.smt_eq(A.abs, zero)));
+      break;
+    case Instruction::SRem:
+      facts.push_back(solver.smt_implies(rhsZero, solver.smt_eq(A.abs, A.lhs)));
+      facts.push_back(solver.smt_implies(rhsOne, solver.smt_eq(A.abs, zero)));
+      facts.push_back(solver.smt_implies(lhsZero, solver.smt_eq(A.abs, zero)));
+      break;
+    default:
+      llvm_unreachable("not an abstracted operator");
+    }
+  }
+
+  auto expr = solver.smt_true();
+  for (auto fact: facts)
+    expr = solver.smt_and(expr, fact);
+  return expr;
+}
+
+void ValueConstraint::addLemma(SMTExpr e) {
+  if (!lemmas) {
+    lemmas = e;
+    return;
+  }
+  lemmas = solver.smt_and(lemmas, e);
+}
+
+SMTExpr ValueConstraint::takeLemmas() {
+  auto expr = lemmas ? lemmas : solver.smt_true();
+  lemmas = nullptr;
+  return expr;
+}
+
+// The exact operator on concrete values, with SMT-LIB semantics for
+// division by zero.
+static APInt evalAbstraction(unsigned opcode, bool isOverflow, bool isSigned,
+                             const APInt &a, const APInt &b) {
+  bool overflow;
+
+  if (isOverflow) {
+    (void)(isSigned ? a.smul_ov(b, overflow) : a.umul_ov(b, overflow));
+    return APInt(1, overflow);
+  }
+
+  switch (opcode) {
+  case Instruction::Mul:
+    return a * b;
+  case Instruction::UDiv:
+    return b.isZero() ? APInt::getAllOnesValue(a.getBitWidth()) : a.udiv(b);
+  case Instruction::SDiv:
+    if (b.isZero())
+      return a.isNegative() ? APInt(a.getBitWidth(), 1) : APInt::getAllOnesValue(a.getBitWidth());
+    return a.sdiv(b);
+  case Instruction::URem:
+    return b.isZero() ? a : a.urem(b);
+  case Instruction::SRem:
+    return b.isZero() ? a : a.srem(b);
+  default:
+    llvm_unreachable("not an abstracted operator");
+  }
+}
+
+unsigned ValueConstraint::refineAbstractions() {
+  unsigned refined = 0;
+
+  for (auto &A: abstractions) {
+    if (A.refined)
+      continue;
+
+    auto expected = evalAbstraction(A.opcode, A.isOverflow, A.isSigned,
+                                    solver.smt_assignment(A.lhs),
+                                    solver.smt_assignment(A.rhs));
+    if (expected == solver.smt_assignment(A.abs))
+      continue;
+
+    auto exact = calcExactConstraint(A);
+    auto eqExpr = solver.smt_eq(A.abs, exact);
+    solver.smt_assert(eqExpr);
+    A.refined = true;
+    ++refined;
+    ++NumRefined;
+  }
+
+  return refined;
+}
+
 // Ref: https://github.com/CRYPTOlab/kint/blob/master/src/ValueGen.cc#L298
+SMTExpr ValueConstraint::calcPHIConstraint(PHINode *PN) {
+  // Free if no incoming path is taken
+  auto expr = varConstraint(PN);
+
+  for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+    auto *V = PN->getIncomingValue(i);
+    if (isa<UndefValue>(V))
+      continue;
+    auto edgeExpr = phiPaths->calcEdgeConstraint(PN->getIncomingBlock(i), PN->getParent());
+    auto valExpr = calcConstraint(V);
+    expr = solver.smt_cond(edgeExpr, valExpr, expr);
+  }
+  return expr;
+}
+
+// The result of a direct call is the summary of the callee, with its
+// parameters bound to the actual arguments.
+SMTExpr ValueConstraint::calcCallConstraint(CallInst *CI) {
+  auto *F = CI->getCalledFunction();
+  if (!F || !isAnalyzable(CI->getType()))
+    return varConstraint(CI);
+
+  if (!summaries || !summaryDepth || !summaries->isUsable(F)) {
+    auto expr = varConstraint(CI);
+    if (auto *facts = lookupFacts(F))
+      expr = clampToRange(expr, facts->ret);
+    return expr;
+  }
+
+  // Computing the summary may compute others, so it comes first.
+  auto &S = summaries->get(F, summaryDepth, index);
+  SmallVector<SMTExpr, 4> args;
+  for (auto &A: F->args())
+    args.push_back(S.params[A.getArgNo()] ? calcConstraint(CI->getArgOperand(A.getArgNo())) : nullptr);
+
+  auto calleePrefix = prefix + F->getName().str() + "#" + std::to_string(numCalls++) + ":";
+  auto expr = summaries->instantiate(S, args, solver, calleePrefix);
+
+  ++NumSummarized;
+  return expr;
+}
+
+// Only meaningful if the index covers the whole program, every caller of
+// the function included.
+SMTExpr ValueConstraint::calcArgConstraint(Argument *A) {
+  auto expr = varConstraint(A);
+  auto *facts = indexArgs ? lookupFacts(A->getParent()) : nullptr;
+  if (!facts || !facts->knowsArgs() || A->getArgNo() >= facts->args.size())
+    return expr;
+
+  return clampToRange(expr, facts->args[A->getArgNo()]);
+}
+
+// e if it lies in CR, else the lower bound of CR. Cheaper for the solver
+// than a side constraint, and needs no place in the query.
+SMTExpr ValueConstraint::clampToRange(SMTExpr e, const ConstantRange &CR) {
+  if (CR.isFullSet() || CR.isEmptySet() || CR.getBitWidth() != solver.smt_get_width(e))
+    return e;
+
+  auto loExpr = solver.smt_const(CR.getLower());
+  auto sizeExpr = solver.smt_const(CR.getUpper() - CR.getLower());
+  // Wraps around for a wrapped range too
+  auto offExpr = solver.smt_sub(e, loExpr);
+  auto inExpr = solver.smt_ult(offExpr, sizeExpr);
+  return solver.smt_cond(inExpr, e, loExpr);
+}
+
+// Local functions are left out of the index, their names need not be unique.
+const FunctionFacts *ValueConstraint::lookupFacts(const Function *F) {
+  if (!index || F->hasLocalLinkage())
+    return nullptr;
+  return index->lookup(F->getName());
+}
+
 bool ValueConstraint::isAnalyzable(const Type *Ty) {
+	if (auto *VTy = dyn_cast<FixedVectorType>(Ty))
+		return VTy->getElementType()->isIntegerTy() || VTy->getElementType()->isPointerTy();
 	return Ty->isIntegerTy()
 		|| Ty->isPointerTy()
 		|| Ty->isFunctionTy();
 }
+
+unsigned ValueConstraint::getNumLanes(const Type *Ty) {
+  auto *VTy = dyn_cast<FixedVectorType>(Ty);
+  return VTy ? VTy->getNumElements() : 1;
+}
+
+SMTExpr ValueConstraint::getLane(SMTExpr e, unsigned numLanes, unsigned lane) {
+  if (numLanes == 1)
+    return e;
+  auto width = solver.smt_get_width(e) / numLanes;
+  return solver.smt_slice(e, (lane + 1) * width - 1, lane * width);
+}
+
+// Takes the lanes over
+SMTExpr ValueConstraint::concatLanes(ArrayRef<SMTExpr> lanes) {
+  auto expr = lanes.back();
+  for (auto lane: reverse(lanes.drop_back()))
+    expr = solver.smt_concat(expr, lane);
+  return expr;
+}
+
+SMTExpr ValueConstraint::mapLanes(unsigned numLanes, ArrayRef<SMTExpr> ops,
+                                  function_ref<SMTExpr(ArrayRef<SMTExpr>)> f) {
+  SmallVector<SMTExpr, 8> lanes;
+  SmallVector<SMTExpr, 3> args;
+  for (unsigned i = 0; i < numLanes; ++i) {
+    args.clear();
+    for (auto e: ops)
+      args.push_back(getLane(e, numLanes, i));
+    lanes.push_back(f(args));
+  }
+  return concatLanes(lanes);
+}
+
+// index == lane, false if the index is too narrow to name the lane
+SMTExpr ValueConstraint::laneEquals(SMTExpr index, unsigned lane) {
+  auto width = solver.smt_get_width(index);
+  if (!isUIntN(width, lane))
+    return solver.smt_false();
+  auto laneExpr = solver.smt_const(APInt(width, lane));
+  return solver.smt_eq(index, laneExpr);
+}
+
+// An index out of range gives poison, which is left free.
+SMTExpr ValueConstraint::calcExtractElementConstraint(ExtractElementInst *EEI) {
+  auto *VTy = dyn_cast<FixedVectorType>(EEI->getVectorOperandType());
+  if (!VTy || !isAnalyzable(VTy))
+    return varConstraint(EEI);
+
+  auto numLanes = VTy->getNumElements();
+  auto *Idx = EEI->getIndexOperand();
+  auto *CI = dyn_cast<ConstantInt>(Idx);
+  if (CI && CI->getValue().uge(numLanes))
+    return varConstraint(EEI);
+
+  auto vecExpr = calcConstraint(EEI->getVectorOperand());
+  SMTExpr expr;
+  if (CI) {
+    expr = getLane(vecExpr, numLanes, CI->getZExtValue());
+  } else {
+    expr = varConstraint(EEI);
+    auto idxExpr = calcConstraint(Idx);
+    for (unsigned i = 0; i < numLanes; ++i) {
+      auto isLane = laneEquals(idxExpr, i);
+      auto laneExpr = getLane(vecExpr, numLanes, i);
+      expr = solver.smt_cond(isLane, laneExpr, expr);
+    }
+  }
+  return expr;
+}
+
+// An index out of range gives poison; the vector is left as it is.
+SMTExpr ValueConstraint::calcInsertElementConstraint(InsertElementInst *IEI) {
+  auto *VTy = dyn_cast<FixedVectorType>(IEI->getType());
+  if (!VTy || !isAnalyzable(VTy))
+    return varConstraint(IEI);
+
+  auto numLanes = VTy->getNumElements();
+  auto vecExpr = calcConstraint(IEI->getOperand(0));
+  auto eltExpr = calcConstraint(IEI->getOperand(1));
+  auto idxExpr = calcConstraint(IEI->getOperand(2));
+
+  SmallVector<SMTExpr, 8> lanes;
+  for (unsigned i = 0; i < numLanes; ++i) {
+    auto isLane = laneEquals(idxExpr, i);
+    auto laneExpr = getLane(vecExpr, numLanes, i);
+    lanes.push_back(solver.smt_cond(isLane, eltExpr, laneExpr));
+  }
+  return concatLanes(lanes);
+}
+
+// Undefined lanes of the mask are left free.
+SMTExpr ValueConstraint::calcShuffleVectorConstraint(ShuffleVectorInst *SVI) {
+  auto *VTy = dyn_cast<FixedVectorType>(SVI->getType());
+  auto *SrcTy = dyn_cast<FixedVectorType>(SVI->getOperand(0)->getType());
+  if (!VTy || !SrcTy || !isAnalyzable(VTy))
+    return varConstraint(SVI);
+
+  auto numLanes = VTy->getNumElements();
+  auto numSrcLanes = SrcTy->getNumElements();
+  auto e1 = calcConstraint(SVI->getOperand(0));
+  auto e2 = calcConstraint(SVI->getOperand(1));
+  SMTExpr undef = nullptr;
+
+  SmallVector<SMTExpr, 8> lanes;
+  for (unsigned i = 0; i < numLanes; ++i) {
+    int m = SVI->getMaskValue(i);
+    if (m < 0) {
+      if (!undef)
+        undef = varConstraint(SVI);
+      lanes.push_back(getLane(undef, numLanes, i));
+    } else if (static_cast<unsigned>(m) < numSrcLanes) {
+      lanes.push_back(getLane(e1, numSrcLanes, m));
+    } else {
+      lanes.push_back(getLane(e2, numSrcLanes, m - numSrcLanes));
+    }
+  }
+  return concatLanes(lanes);
+}
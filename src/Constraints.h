@@ -3,18 +3,83 @@
 
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Operator.h>
 #include <llvm/IR/Type.h>
+#include <map>
+#include <memory>
 #include <set>
+#include <string>
 #include "SMTSolver.h"
+#include "SummaryIndex.h"
+
+class PathConstraint;
+
+// The return value of a function as a term over its parameters: a select
+// over the paths to its returns, each with its returned value. Only small
+// loop-free functions are summarized, so every path can be encoded exactly.
+// The terms live in the arena of the SummaryCache.
+struct FunctionSummary {
+  SMTExpr ret = nullptr;
+  // By argument number, null for parameters that are not analyzable
+  llvm::SmallVector<SMTExpr, 4> params;
+};
+
+// Summaries of the functions of one module, each computed on first use for
+// a given nesting depth and then instantiated at every call site.
+class SummaryCache {
+  std::shared_ptr<SMTTermArena> arena;
+  // Node-based, as computing a summary computes those of its callees
+  std::map<std::pair<const llvm::Function *, unsigned>, FunctionSummary> summaries;
+  llvm::DenseMap<const llvm::Function *, bool> usable;
+  unsigned maxInsts = 0;
+
+public:
+  void reset(unsigned maxInsts);
+  // Whether calls to F can be encoded from its summary
+  bool isUsable(const llvm::Function *F);
+  // The summary of a usable F, with the calls in F encoded from summaries
+  // nesting up to depth - 1 calls deep
+  const FunctionSummary &get(llvm::Function *F, unsigned depth, const SummaryIndex *);
+  // The return value of a call to the summarized function, with args as its
+  // parameters and fresh variables, named after prefix, for everything else
+  SMTExpr instantiate(const FunctionSummary &, llvm::ArrayRef<SMTExpr> args,
+                      SMTSolver &, llvm::StringRef prefix);
+};
 
 class ValueConstraint {
   SMTSolver &solver;
   const llvm::DataLayout &DL;
 
+  // A nonlinear term replaced by a fresh variable, see setAbstractNonlinear().
+  struct Abstraction {
+    unsigned opcode;
+    bool isOverflow; // abs is the overflow bit of lhs * rhs, not its value
+    bool isSigned;
+    SMTExpr lhs, rhs, abs;
+    bool refined;
+  };
+
+  unsigned abstractMinWidth = 0;
+  llvm::SmallVector<Abstraction, 8> abstractions;
+  SMTExpr lemmas = nullptr;
+
+  unsigned narrowWidth = 0;
+
+  SummaryCache *summaries = nullptr;
+  unsigned summaryDepth = 0;
+  const SummaryIndex *index = nullptr;
+  bool indexArgs = true;
+  // Keeps the variables of each inlined callee apart from the caller's
+  std::string prefix;
+  unsigned numCalls = 0;
+  // When set, PHIs are encoded as a select over the incoming paths of this
+  // acyclic function rather than as free variables.
+  PathConstraint *phiPaths = nullptr;
+
   SMTExpr calcInstConstraint(llvm::Instruction *);
   SMTExpr calcConstConstraint(llvm::Constant *);
   SMTExpr varConstraint(llvm::Value *);
@@ -30,11 +95,44 @@ class ValueConstraint {
   SMTExpr calcBitCastConstraint(llvm::BitCastInst *);
   SMTExpr calcIntToPtrConstraint(llvm::IntToPtrInst *);
   SMTExpr calcPtrToIntConstraint(llvm::PtrToIntInst *);
+  SMTExpr calcPHIConstraint(llvm::PHINode *);
+  SMTExpr calcExtractElementConstraint(llvm::ExtractElementInst *);
+  SMTExpr calcInsertElementConstraint(llvm::InsertElementInst *);
+  SMTExpr calcShuffleVectorConstraint(llvm::ShuffleVectorInst *);
+  SMTExpr calcVectorConstConstraint(llvm::Constant *, llvm::FixedVectorType *);
+  SMTExpr calcCallConstraint(llvm::CallInst *);
+  SMTExpr calcArgConstraint(llvm::Argument *);
+  SMTExpr clampToRange(SMTExpr, const llvm::ConstantRange &);
+  SMTExpr calcBinOp(unsigned opcode, SMTExpr, SMTExpr);
+  SMTExpr calcICmp(llvm::CmpInst::Predicate, SMTExpr, SMTExpr);
+  SMTExpr calcOverflowOp(unsigned opcode, bool nsw, SMTExpr, SMTExpr);
+
+  // A fixed-width vector is the concatenation of its lanes, lane 0 in the
+  // lowest bits, as a little-endian target stores it; a scalar is a vector
+  // of one lane. mapLanes() applies f to the same lane of every operand and
+  // concatenates the results.
+  SMTExpr getLane(SMTExpr, unsigned numLanes, unsigned lane);
+  SMTExpr concatLanes(llvm::ArrayRef<SMTExpr> lanes);
+  SMTExpr mapLanes(unsigned numLanes, llvm::ArrayRef<SMTExpr> ops,
+                   llvm::function_ref<SMTExpr(llvm::ArrayRef<SMTExpr>)> f);
+  SMTExpr laneEquals(SMTExpr index, unsigned lane);
+  const FunctionFacts *lookupFacts(const llvm::Function *);
+
+  bool shouldAbstract(unsigned opcode, llvm::Value *, llvm::Value *);
+  SMTExpr abstractOp(unsigned opcode, bool isOverflow, bool isSigned, SMTExpr, SMTExpr);
+  SMTExpr calcExactConstraint(const Abstraction &);
+  SMTExpr calcLemmaConstraint(const Abstraction &);
+  void addLemma(SMTExpr);
 
   static bool isAnalyzable(const llvm::Type *);
 
 public:
+  // Lanes of a fixed-width vector type, 1 for anything else
+  static unsigned getNumLanes(const llvm::Type *);
+
   llvm::DenseMap<llvm::Value *, SMTExpr> valueToExpr;
+  // Values encoded as free variables, in creation order
+  llvm::SmallVector<llvm::Value *, 16> leaves;
 
   ValueConstraint(SMTSolver &solver, const llvm::DataLayout &DL) : solver(solver), DL(DL) {}
   ~ValueConstraint() = default;
@@ -45,27 +143,90 @@ public:
   ValueConstraint &operator=(const ValueConstraint &) = delete;
   ValueConstraint &operator=(ValueConstraint &&) = delete;
 
+  SMTSolver &getSolver() { return solver; }
+
   SMTExpr calcConstraint(llvm::Value *);
   SMTExpr calcOverflowConstraint(llvm::CallInst *);
+  SMTExpr calcOverflowConstraint(unsigned opcode, llvm::Value *, llvm::Value *, bool nsw);
   SMTExpr calcShiftDivConstraint(llvm::CallInst *);
 
+  // Encode mul/udiv/sdiv/urem/srem of at least minWidth bits with two
+  // non-constant operands, and the overflow bit of such a mul, as fresh
+  // variables constrained only by cheap lemmas (0 disables). The result
+  // over-approximates: UNSAT is final, a SAT model has to pass
+  // refineAbstractions().
+  void setAbstractNonlinear(unsigned minWidth) { abstractMinWidth = minWidth; }
+  // Encode free variables wider than width as a width-bit variable sign
+  // extended to full width (0 disables). Every model of the narrowed query
+  // is a model of the full one, but UNSAT proves nothing.
+  void setNarrowWidth(unsigned width) { narrowWidth = width; }
+  // Encode the result of a direct call to a function with a usable summary
+  // as the summary instantiated with the actual arguments, nesting up to
+  // depth calls deep (0 disables).
+  void setSummaries(SummaryCache *cache, unsigned depth) {
+    summaries = cache;
+    summaryDepth = depth;
+  }
+  // Bound the results of calls to, and unless argRanges is false the
+  // arguments of, functions that are not local to the module by the ranges
+  // recorded in a whole-program index.
+  void setSummaryIndex(const SummaryIndex *idx, bool argRanges = true) {
+    index = idx;
+    indexArgs = argRanges;
+  }
+  // The conjunction of the lemmas of all abstractions created so far;
+  // must be part of the query.
+  SMTExpr takeLemmas();
+  // Check each abstraction against the current model, and assert the exact
+  // encoding for the ones it got wrong. Returns how many were refined, 0
+  // meaning the model is a genuine one.
+  unsigned refineAbstractions();
+
   friend class PathConstraint;
+  friend class SummaryCache;
 };
 
 class PathConstraint {
   ValueConstraint &ValCon;
   SMTSolver &solver;
   const std::set<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> backEdgesSet;
-
+  std::set<const llvm::BasicBlock *> loopHeaders;
+  // Leave PHIs of loop headers unconstrained, so that the path constraint
+  // over-approximates every iteration instead of just the first one. Needed
+  // whenever an UNSAT answer is used as a proof.
+  const bool havocLoopPhis;
+
+  // The case values of a switch, sorted and merged into maximal runs of
+  // consecutive values, so that an edge is encoded per run rather than per
+  // case. Computed once per switch, however many successors it has.
+  struct SwitchRanges {
+    typedef std::pair<llvm::APInt, llvm::APInt> Range;
+    SMTExpr cond = nullptr;
+    // Runs of values all going to the same block
+    llvm::DenseMap<const llvm::BasicBlock *, llvm::SmallVector<Range, 1>> cases;
+    // Whether cond matches any case, i.e. the default edge is not taken
+    SMTExpr anyCase = nullptr;
+  };
+  llvm::DenseMap<const llvm::SwitchInst *, SwitchRanges> switchRanges;
+
+  const SwitchRanges &getSwitchRanges(llvm::SwitchInst *SI);
+  SMTExpr calcRangeConstraint(SMTExpr cond, const SwitchRanges::Range &R);
   SMTExpr calcAssignConstraint(llvm::BasicBlock *BB, llvm::BasicBlock *Pred);
   SMTExpr calcBrConstraint(llvm::Instruction *I, llvm::BasicBlock *BB);
+  SMTExpr calcEdgeConstraint(llvm::BasicBlock *Pred, llvm::BasicBlock *BB);
 
 public:
   llvm::DenseMap<llvm::BasicBlock *, SMTExpr> BBToExpr;
 
   PathConstraint(ValueConstraint &VC,
-    llvm::ArrayRef<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> BE) :
-    ValCon(VC), solver(VC.solver), backEdgesSet(BE.begin(), BE.end()) {}
+    llvm::ArrayRef<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>> BE,
+    bool havocLoopPhis = false) :
+    ValCon(VC), solver(VC.solver), backEdgesSet(BE.begin(), BE.end()),
+    havocLoopPhis(havocLoopPhis)
+  {
+    for (auto &E: BE)
+      loopHeaders.insert(E.second);
+  }
   ~PathConstraint() = default;
 
   // don't allow copy/move
@@ -76,6 +237,12 @@ public:
 
   SMTExpr calcConstraint(llvm::Instruction *I);
   SMTExpr calcConstraint(llvm::BasicBlock *BB);
+  // The branch condition taking Pred to BB, without the path to Pred
+  SMTExpr calcBranchConstraint(llvm::BasicBlock *Pred, llvm::BasicBlock *BB) {
+    return calcBrConstraint(Pred->getTerminator(), BB);
+  }
+
+  friend class ValueConstraint;
 };
 
 #endif /* CONSTRAINTS_H */
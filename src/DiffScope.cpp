@@ -0,0 +1,152 @@
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include "DiffScope.h"
+
+using namespace llvm;
+
+// Merge with every range it overlaps or adjoins.
+void DiffScope::merge(Ranges &ranges, unsigned first, unsigned last) {
+  auto it = ranges.upper_bound(first);
+  if (it != ranges.begin() && std::prev(it)->second + 1 >= first) {
+    --it;
+    first = it->first;
+    last = std::max(last, it->second);
+    it = ranges.erase(it);
+  }
+  while (it != ranges.end() && it->first <= last + 1) {
+    last = std::max(last, it->second);
+    it = ranges.erase(it);
+  }
+  ranges.emplace(first, last);
+}
+
+void DiffScope::addLines(StringRef file, unsigned first, unsigned last) {
+  merge(files[file], first, last);
+  fileCache.clear();
+}
+
+bool DiffScope::loadDiff(StringRef path, std::string &err) {
+  auto buf = MemoryBuffer::getFile(path);
+  if (!buf) {
+    err = buf.getError().message();
+    return false;
+  }
+
+  SmallVector<StringRef, 0> lines;
+  (*buf)->getBuffer().split(lines, '\n');
+
+  // Only headers appear outside of hunks, and only body lines inside.
+  std::string file;
+  bool gitDiff = false, gitPrefix = false;
+  unsigned oldLeft = 0, newLeft = 0, line = 0;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    auto L = lines[i].rtrim('\r');
+
+    if (oldLeft || newLeft) {
+      if (L.startswith("\\"))
+        continue;
+      char c = L.empty() ? ' ' : L[0];
+      if ((c == ' ' && (!oldLeft || !newLeft)) || (c == '-' && !oldLeft) ||
+          (c == '+' && !newLeft) || (c != ' ' && c != '-' && c != '+')) {
+        err = "bad hunk line " + std::to_string(i + 1);
+        return false;
+      }
+      if (c != '+')
+        --oldLeft;
+      if (c != '-')
+        --newLeft;
+      if (c != ' ' && !file.empty())
+        addLines(file, line, line);
+      if (c != '-')
+        ++line;
+      continue;
+    }
+
+    if (L.startswith("diff ")) {
+      gitDiff = L.startswith("diff --git a/");
+    } else if (L.startswith("--- ")) {
+      // A new file has no old name to tell the prefix by.
+      auto name = L.substr(4).split('\t').first.rtrim();
+      gitPrefix = name.startswith("a/") || (name == "/dev/null" && gitDiff);
+    } else if (L.startswith("+++ ")) {
+      auto name = L.substr(4).split('\t').first.rtrim();
+      if (name == "/dev/null")
+        file.clear();
+      else
+        file = (gitPrefix && name.startswith("b/") ? name.substr(2) : name).str();
+    } else if (L.startswith("@@ ")) {
+      // @@ -<old>[,<count>] +<new>[,<count>] @@
+      SmallVector<StringRef, 4> fields;
+      L.split(fields, ' ', 3, false);
+      auto parse = [](StringRef range, unsigned &start, unsigned &count) {
+        StringRef first, num;
+        std::tie(first, num) = range.drop_front().split(',');
+        count = 1;
+        return !first.getAsInteger(10, start) && (num.empty() || !num.getAsInteger(10, count));
+      };
+      unsigned oldStart;
+      if (fields.size() < 3 || !fields[1].startswith("-") || !fields[2].startswith("+") ||
+          !parse(fields[1], oldStart, oldLeft) || !parse(fields[2], line, newLeft)) {
+        err = "bad hunk header on line " + std::to_string(i + 1);
+        return false;
+      }
+      // An empty new range starts at the line before it.
+      if (!newLeft)
+        ++line;
+    }
+  }
+  return true;
+}
+
+bool DiffScope::addRange(StringRef spec, std::string &err) {
+  StringRef file, range, first, last;
+  std::tie(file, range) = spec.trim().rsplit(':');
+  std::tie(first, last) = range.split('-');
+  unsigned from = 0, to = 0;
+  bool ok = !file.empty() && !first.getAsInteger(10, from);
+  to = from;
+  if (ok && !last.empty())
+    ok = !last.getAsInteger(10, to) && to >= from;
+  if (!ok) {
+    err = "expected <file>:<line>[-<line>], got '" + spec.str() + "'";
+    return false;
+  }
+  addLines(file, from, to);
+  return true;
+}
+
+const DiffScope::Ranges &DiffScope::lookup(const DIFile *F) const {
+  auto it = fileCache.find(F);
+  if (it != fileCache.end())
+    return it->second;
+
+  SmallString<256> path(F->getFilename());
+  if (!sys::path::is_absolute(path)) {
+    path = F->getDirectory();
+    sys::path::append(path, F->getFilename());
+  }
+  sys::path::remove_dots(path, true);
+
+  Ranges found;
+  for (auto &KV: files) {
+    auto name = KV.first();
+    name.consume_front("./");
+    StringRef full(path);
+    if (full == name ||
+        (full.endswith(name) && sys::path::is_separator(full[full.size() - name.size() - 1]))) {
+      for (auto &R: KV.second)
+        merge(found, R.first, R.second);
+    }
+  }
+  return fileCache[F] = std::move(found);
+}
+
+bool DiffScope::contains(const DILocation *Loc) const {
+  if (!Loc || !Loc->getFile())
+    return false;
+  auto &ranges = lookup(Loc->getFile());
+  auto it = ranges.upper_bound(Loc->getLine());
+  return it != ranges.begin() && std::prev(it)->second >= Loc->getLine();
+}
@@ -0,0 +1,40 @@
+#ifndef DIFFSCOPE_H
+#define DIFFSCOPE_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <map>
+#include <string>
+
+// The source lines touched by a change, read from a unified diff or given
+// as file:line ranges. A debug location is in scope if its line is, in a
+// file whose path ends with the path named by the change, so that paths
+// relative to the root of a repository match wherever it was built.
+class DiffScope {
+  // First to last line of every touched range, disjoint
+  typedef std::map<unsigned, unsigned> Ranges;
+  llvm::StringMap<Ranges> files;
+  // Ranges of every name matching a file, merged
+  mutable llvm::DenseMap<const llvm::DIFile *, Ranges> fileCache;
+
+  static void merge(Ranges &, unsigned first, unsigned last);
+  const Ranges &lookup(const llvm::DIFile *) const;
+
+public:
+  bool empty() const { return files.empty(); }
+
+  void addLines(llvm::StringRef file, unsigned first, unsigned last);
+  // Lines added or changed by a unified diff, in the new version of each
+  // file. A deletion touches the line that now follows it. Paths lose the
+  // a/ and b/ prefixes of git diffs. Returns false and
+  // sets err if path cannot be read or parsed.
+  bool loadDiff(llvm::StringRef path, std::string &err);
+  // <file>:<line> or <file>:<first>-<last>
+  bool addRange(llvm::StringRef spec, std::string &err);
+
+  bool contains(const llvm::DILocation *) const;
+};
+
+#endif /* DIFFSCOPE_H */
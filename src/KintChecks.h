@@ -0,0 +1,98 @@
+#ifndef KINTCHECKS_H
+#define KINTCHECKS_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <string>
+
+// A hoisted check and the instruction it guards share one distinct node under
+// this kind, so the check can still be traced back to its site.
+#define KINT_SITE_MD "kint.site"
+
+// Set by -kint-taint on checks whose operation depends on untrusted input,
+// and on those of them whose result also flows into a sink such as an
+// allocation size. The pass names the module itself with KINT_TAINT_MD once
+// it has run.
+#define KINT_TAINT_MD "kint.taint"
+#define KINT_SINK_MD "kint.sink"
+
+enum KINT_TYPE : unsigned {
+  KINT_NONE = 0,
+  KINT_OVERFLOW = 1,
+  KINT_SHIFT_DIV = 2,
+};
+
+static inline KINT_TYPE matchKintFunc(const llvm::Function *F) {
+  if (!F)
+    return KINT_NONE;
+
+  auto name = static_cast<std::string>(F->getName());
+  if (name.compare(0, 15, "__kint_overflow") == 0)
+    return KINT_OVERFLOW;
+  else if (name.compare(0, 16, "__kint_shift_div") == 0)
+    return KINT_SHIFT_DIV;
+  else
+    return KINT_NONE;
+}
+
+static inline KINT_TYPE matchKintCheck(const llvm::Instruction *I) {
+  auto *CI = llvm::dyn_cast<llvm::CallInst>(I);
+  return CI ? matchKintFunc(CI->getCalledFunction()) : KINT_NONE;
+}
+
+// Checks are inserted right before the instruction they guard, which is
+// where we find it unless the check has been hoisted.
+static inline llvm::Instruction *getCheckedInst(llvm::CallInst *CI) {
+  auto *site = CI->getMetadata(KINT_SITE_MD);
+  auto *next = CI->getNextNode();
+  if (!site || next->getMetadata(KINT_SITE_MD) == site)
+    return next;
+
+  for (auto &BB: *CI->getFunction()) {
+    for (auto &I: BB) {
+      if (&I != CI && I.getMetadata(KINT_SITE_MD) == site)
+        return &I;
+    }
+  }
+  return next;
+}
+
+// getCheckedInst() for the checks of one function at a time, with the sites
+// of all its hoisted checks found in one scan rather than one per check.
+class CheckedInstFinder {
+  llvm::Function *F = nullptr;
+  llvm::DenseMap<const llvm::MDNode *, llvm::Instruction *> sites;
+
+public:
+  // Must be called before moving on to a function that may reuse the
+  // address of a freed one.
+  void reset() {
+    F = nullptr;
+    sites.clear();
+  }
+
+  llvm::Instruction *get(llvm::CallInst *CI) {
+    auto *site = CI->getMetadata(KINT_SITE_MD);
+    auto *next = CI->getNextNode();
+    if (!site || next->getMetadata(KINT_SITE_MD) == site)
+      return next;
+
+    if (CI->getFunction() != F) {
+      F = CI->getFunction();
+      sites.clear();
+      for (auto &BB: *F) {
+        for (auto &I: BB) {
+          auto *N = I.getMetadata(KINT_SITE_MD);
+          if (N && !matchKintCheck(&I))
+            sites[N] = &I;
+        }
+      }
+    }
+    auto *I = sites.lookup(site);
+    return I ? I : next;
+  }
+};
+
+#endif /* KINTCHECKS_H */
@@ -0,0 +1,58 @@
+#include <llvm/Support/Format.h>
+#include <algorithm>
+#include <cstdio>
+#include "MemoryStats.h"
+#include "SMTSolver.h"
+
+using namespace llvm;
+
+// Writing 5 to clear_refs lowers the kernel's high-water mark of the
+// resident set (VmHWM) to the current resident set, so that it measures
+// one function at a time. Both fail quietly without /proc.
+static void resetPeakRSS() {
+  if (auto *F = fopen("/proc/self/clear_refs", "w")) {
+    fputs("5", F);
+    fclose(F);
+  }
+}
+
+// In KB
+static uint64_t getPeakRSS() {
+  auto *F = fopen("/proc/self/status", "r");
+  if (!F)
+    return 0;
+  char line[256];
+  unsigned long long kb = 0;
+  while (fgets(line, sizeof(line), F)) {
+    if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+      break;
+  }
+  fclose(F);
+  return kb;
+}
+
+void MemoryStats::start() {
+  resetPeakRSS();
+  SMTSolver::smt_take_peak_nodes();
+}
+
+uint64_t MemoryStats::finish(StringRef name) {
+  auto rss = getPeakRSS();
+  entries.push_back(Entry{ name.str(), rss, SMTSolver::smt_take_peak_nodes() });
+  return rss;
+}
+
+void MemoryStats::print(raw_ostream &OS, size_t maxFunctions) {
+  std::sort(entries.begin(), entries.end(), [](const Entry &A, const Entry &B) {
+    return A.peakRSS > B.peakRSS;
+  });
+  if (entries.size() > maxFunctions)
+    entries.resize(maxFunctions);
+
+  OS << "Peak memory of the " << entries.size() << " largest functions:\n";
+  for (auto &E: entries) {
+    OS << "  " << E.function << ": " << format("%.1f", E.peakRSS / 1024.0)
+       << " MB resident, " << E.peakNodes << " solver nodes\n";
+  }
+  entries.clear();
+}
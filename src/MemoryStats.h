@@ -0,0 +1,35 @@
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Peak resident set of the process and peak solver nodes while analyzing
+// each function, for -kint-memory-stats. The resident set comes from /proc;
+// without it every function reads as 0 KB.
+class MemoryStats {
+  struct Entry {
+    std::string function;
+    // In KB
+    uint64_t peakRSS;
+    size_t peakNodes;
+  };
+
+  std::vector<Entry> entries;
+
+public:
+  // Start measuring from the current resident set and solver nodes.
+  static void start();
+  // Record the peaks since start() for function name, and return the peak
+  // resident set in KB.
+  uint64_t finish(llvm::StringRef name);
+
+  // Print the functions with the highest peak resident set, and forget them.
+  void print(llvm::raw_ostream &, size_t maxFunctions = 10);
+  void clear() { entries.clear(); }
+};
+
+#endif
@@ -0,0 +1,30 @@
+#include <llvm/ADT/Statistic.h>
+#include "PersistentState.h"
+#include "SMTTerm.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumVerdictHits, "Number of queries answered by a verdict kept from an earlier module");
+
+PersistentState &PersistentState::get() {
+  static PersistentState state;
+  return state;
+}
+
+bool PersistentState::lookupVerdict(SMTExpr query, std::string &key, bool &sat) {
+  serializeTerm(query, key);
+  auto it = verdicts.find(key);
+  if (it == verdicts.end())
+    return false;
+  sat = it->second;
+  ++NumVerdictHits;
+  return true;
+}
+
+void PersistentState::storeVerdict(StringRef key, bool sat, size_t maxVerdicts) {
+  if (verdicts.size() >= maxVerdicts)
+    verdicts.clear();
+  verdicts[key] = sat;
+}
@@ -0,0 +1,37 @@
+#ifndef PERSISTENTSTATE_H
+#define PERSISTENTSTATE_H
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <memory>
+#include <string>
+#include "SMTSolver.h"
+#include "SolverPool.h"
+#include "SummaryIndex.h"
+
+// What -kint-persist keeps from one module to the next, for as long as the
+// process lives. A pass takes the pool and the index for the module, and
+// only puts them back if it finishes.
+class PersistentState {
+  // SAT or UNSAT of plain queries, by serializeTerm()
+  llvm::StringMap<bool> verdicts;
+
+public:
+  std::unique_ptr<SolverPool> pool;
+  // The options the pool was started with
+  std::string poolKey;
+  SummaryIndex index;
+  // The -kint-summary-index files and their modification times
+  std::string indexKey;
+
+  // The state of this process
+  static PersistentState &get();
+
+  // Look up the verdict of query, leaving its serialized form in key.
+  bool lookupVerdict(SMTExpr query, std::string &key, bool &sat);
+  // Keep the verdict of the query serialized as key; once maxVerdicts are
+  // kept, the cache starts over.
+  void storeVerdict(llvm::StringRef key, bool sat, size_t maxVerdicts);
+};
+
+#endif
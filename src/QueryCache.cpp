@@ -0,0 +1,112 @@
+#include <algorithm>
+#include "QueryCache.h"
+
+using namespace llvm;
+
+enum PartKind : unsigned {
+  PART_GUARD,
+  PART_PATH,
+  PART_CHECK,
+};
+
+// Cores beyond this many are dropped; a function rarely gets near it
+static const unsigned MaxCores = 4096;
+
+void QueryCache::startFunction(Function &Fn) {
+  F = &Fn;
+  DT.reset(new DominatorTree(Fn));
+  partIds.clear();
+  cores.clear();
+
+  // Only arguments mean something outside their function.
+  for (auto &C: assignments) {
+    C.values.erase(std::remove_if(C.values.begin(), C.values.end(),
+                                  [](const std::pair<const Value *, uint64_t> &V) {
+                                    return !isa<Argument>(V.first);
+                                  }),
+                   C.values.end());
+  }
+  assignments.erase(std::remove_if(assignments.begin(), assignments.end(),
+                                   [](const Counterexample &C) { return C.values.empty(); }),
+                    assignments.end());
+}
+
+unsigned QueryCache::getPartId(const PartKey &key) {
+  return partIds.emplace(key, partIds.size()).first->second;
+}
+
+// Every edge into a block dominating the check with no other predecessor is
+// taken on every path to the check, so its branch condition is implied by
+// the path constraint. Assuming it separately lets cores name the guard
+// rather than the whole path.
+void QueryCache::getKeys(CallInst *CI, KINT_TYPE type, QueryKeys &QK) {
+  auto *BB = CI->getParent();
+
+  if (DT->isReachableFromEntry(BB)) {
+    for (auto *N = DT->getNode(BB); N && N->getIDom(); N = N->getIDom()) {
+      auto *Succ = N->getBlock();
+      auto *Pred = Succ->getSinglePredecessor();
+      if (!Pred)
+        continue;
+      QK.guards.emplace_back(Pred, Succ);
+      QK.keys.push_back(getPartId(PartKey(PART_GUARD, Pred, Succ, nullptr, nullptr)));
+    }
+  }
+
+  const void *args[4] = {};
+  for (unsigned i = 0; i < CI->arg_size() && i < 4; ++i)
+    args[i] = CI->getArgOperand(i);
+  QK.keys.push_back(getPartId(PartKey(PART_CHECK + type, args[0], args[1], args[2], args[3])));
+  QK.keys.push_back(getPartId(PartKey(PART_PATH, BB, nullptr, nullptr, nullptr)));
+}
+
+bool QueryCache::isKnownUnsat(const QueryKeys &QK) const {
+  SmallVector<unsigned, 8> keys(QK.keys.begin(), QK.keys.end());
+  std::sort(keys.begin(), keys.end());
+
+  return std::any_of(cores.begin(), cores.end(), [&](const SmallVector<unsigned, 8> &core) {
+    return std::includes(keys.begin(), keys.end(), core.begin(), core.end());
+  });
+}
+
+bool QueryCache::addCore(ArrayRef<unsigned> keys) {
+  // An empty core would claim every query UNSAT.
+  if (keys.empty() || cores.size() >= MaxCores)
+    return false;
+  cores.emplace_back(keys.begin(), keys.end());
+  std::sort(cores.back().begin(), cores.back().end());
+  return true;
+}
+
+void QueryCache::addAssignment(const Function *Fn, Assignment values) {
+  if (values.empty())
+    return;
+  for (auto &C: assignments) {
+    if (C.F == Fn && C.values == values)
+      return;
+  }
+
+  assignments.push_front(Counterexample{ Fn, std::move(values) });
+  if (assignments.size() > maxAssignments)
+    assignments.pop_back();
+}
+
+void QueryCache::getAssignments(SmallVectorImpl<Assignment> &result) const {
+  for (auto &C: assignments) {
+    if (C.F == F) {
+      result.push_back(C.values);
+      continue;
+    }
+
+    // Argument i of another function stands for argument i of this one.
+    Assignment values;
+    for (auto &V: C.values) {
+      auto argNo = cast<Argument>(V.first)->getArgNo();
+      if (argNo < F->arg_size() &&
+          F->getArg(argNo)->getType() == V.first->getType())
+        values.emplace_back(F->getArg(argNo), V.second);
+    }
+    if (!values.empty())
+      result.push_back(std::move(values));
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "KintChecks.h"
+
+// Answers queries from the results of earlier ones, in the spirit of KLEE's
+// counterexample cache.
+//
+// SAT answers leave an assignment to the leaves (free variables) of their
+// query, which is tried on later queries by concrete evaluation. Arguments
+// are matched by position, so assignments also carry over to functions with
+// similar signatures.
+//
+// UNSAT answers leave a core: the parts of their query the solver needed.
+// Parts are named independently of any solver, by the guard (branch taken),
+// path or check they encode, so a later query of the same function
+// containing every part of a core is UNSAT as well.
+class QueryCache {
+public:
+  typedef llvm::SmallVector<std::pair<const llvm::Value *, uint64_t>, 8> Assignment;
+
+  // The parts of the query of one check: the guards dominating it, the check
+  // itself and its path constraint, in the order they are assumed.
+  struct QueryKeys {
+    llvm::SmallVector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>, 8> guards;
+    llvm::SmallVector<unsigned, 8> keys;
+  };
+
+private:
+  // (kind, operands...) of a query part
+  typedef std::tuple<unsigned, const void *, const void *, const void *, const void *> PartKey;
+
+  struct Counterexample {
+    const llvm::Function *F;
+    Assignment values;
+  };
+
+  unsigned maxAssignments;
+  // Most recent first
+  std::deque<Counterexample> assignments;
+
+  // Parts and cores only make sense within one function
+  const llvm::Function *F = nullptr;
+  std::unique_ptr<llvm::DominatorTree> DT;
+  std::map<PartKey, unsigned> partIds;
+  std::vector<llvm::SmallVector<unsigned, 8>> cores;
+
+  unsigned getPartId(const PartKey &);
+
+public:
+  explicit QueryCache(unsigned maxAssignments) : maxAssignments(maxAssignments) {}
+
+  void startFunction(llvm::Function &);
+
+  void getKeys(llvm::CallInst *, KINT_TYPE, QueryKeys &);
+  bool isKnownUnsat(const QueryKeys &) const;
+  // keys is a subset of the keys of an UNSAT query; false if not kept
+  bool addCore(llvm::ArrayRef<unsigned> keys);
+
+  void addAssignment(const llvm::Function *, Assignment);
+  // The assignments that may apply to the current function, most recent
+  // first
+  void getAssignments(llvm::SmallVectorImpl<Assignment> &) const;
+};
+
+#endif /* QUERYCACHE_H */
@@ -0,0 +1,192 @@
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <atomic>
+#include "ReportSink.h"
+
+using namespace llvm;
+
+namespace {
+
+// The historical format, one line per report. Checks skipped as cold were
+// never analyzed, so they are only counted, in a line at the end.
+class TextSink : public ReportSink {
+  std::atomic<size_t> numCold{0};
+
+public:
+  explicit TextSink(std::unique_ptr<raw_fd_ostream> file) : ReportSink(std::move(file)) {}
+
+  void finish() override {
+    if (numCold)
+      OS << "Skipped " << numCold << " cold checks below -kint-min-hotness, "
+         << "listed by -kint-report-format=jsonl or sarif\n";
+    ReportSink::finish();
+  }
+
+protected:
+  std::string format(const Report &R, bool) override {
+    if (R.verdict == "cold") {
+      ++numCold;
+      return "";
+    }
+
+    std::string str;
+    raw_string_ostream oss(str);
+    oss << "Possible Integer error";
+    if (R.verdict != "sat")
+      oss << " (" << R.verdict << ")";
+    oss << ": " << R.module << "::" << R.function;
+    if (!R.block.empty())
+      oss << "::" << R.block;
+    oss << ": " << R.inst;
+    for (size_t i = 0; i < R.witness.size(); ++i)
+      oss << (i ? ", " : " [") << R.witness[i].first << " = " << R.witness[i].second
+          << (i + 1 == R.witness.size() ? "]" : "");
+    oss << '\n';
+    return oss.str();
+  }
+};
+
+static json::Object witnessToJSON(const Report &R) {
+  json::Object witness;
+  for (auto &KV: R.witness)
+    witness[KV.first] = KV.second;
+  return witness;
+}
+
+// One JSON object per line
+class JSONLinesSink : public ReportSink {
+public:
+  explicit JSONLinesSink(std::unique_ptr<raw_fd_ostream> file) : ReportSink(std::move(file)) {}
+
+protected:
+  std::string format(const Report &R, bool) override {
+    json::Object obj{
+      {"module", R.module},
+      {"function", R.function},
+      {"block", R.block},
+      {"inst", StringRef(R.inst).trim()},
+      {"file", R.file},
+      {"line", R.line},
+      {"column", R.column},
+      {"kind", ReportSink::getKindName(R.kind)},
+      {"verdict", R.verdict},
+      {"seconds", R.seconds},
+    };
+    if (R.count >= 0)
+      obj["count"] = R.count;
+    if (!R.witness.empty())
+      obj["witness"] = witnessToJSON(R);
+    return formatv("{0}\n", json::Value(std::move(obj))).str();
+  }
+};
+
+// A SARIF 2.1.0 log with a single run. Results are streamed as they come,
+// the enclosing document is opened up front and closed by finish().
+class SARIFSink : public ReportSink {
+public:
+  explicit SARIFSink(std::unique_ptr<raw_fd_ostream> file) : ReportSink(std::move(file)) {
+    OS << "{\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\","
+          "\"version\":\"2.1.0\",\"runs\":[{\"tool\":{\"driver\":{\"name\":\"kint\","
+          "\"rules\":[{\"id\":\"overflow\"},{\"id\":\"shift-div\"}]}},\"results\":[\n";
+  }
+
+  void finish() override {
+    OS << "]}]}\n";
+    ReportSink::finish();
+  }
+
+protected:
+  std::string format(const Report &R, bool first) override {
+    json::Object physical{
+      {"artifactLocation", json::Object{{"uri", R.file.empty() ? R.module : R.file}}},
+    };
+    if (R.line)
+      physical["region"] = json::Object{{"startLine", R.line}, {"startColumn", R.column}};
+
+    json::Object props{
+      {"block", R.block},
+      {"verdict", R.verdict},
+      {"seconds", R.seconds},
+    };
+    if (R.count >= 0)
+      props["count"] = R.count;
+    if (!R.witness.empty())
+      props["witness"] = witnessToJSON(R);
+
+    json::Value result = json::Object{
+      {"ruleId", ReportSink::getKindName(R.kind)},
+      {"level", R.verdict == "cold" ? "note" : "warning"},
+      {"message", json::Object{{"text", "Possible integer error: " + StringRef(R.inst).trim().str()}}},
+      {"locations", json::Array{json::Object{
+        {"physicalLocation", std::move(physical)},
+        {"logicalLocations", json::Array{json::Object{
+          {"fullyQualifiedName", R.function}, {"kind", "function"}}}},
+      }}},
+      {"properties", std::move(props)},
+    };
+    return formatv("{0}{1}\n", first ? "" : ",", result).str();
+  }
+};
+
+} // End anonymous namespace
+
+std::unique_ptr<ReportSink> ReportSink::create(ReportFormat format, StringRef path,
+                                               std::string &err) {
+  std::unique_ptr<raw_fd_ostream> file;
+  if (path.empty()) {
+    // Unlike errs(), buffered unless stderr is a terminal
+    file.reset(new raw_fd_ostream(2, false));
+  } else {
+    std::error_code EC;
+    file.reset(new raw_fd_ostream(path, EC, sys::fs::OF_Text));
+    if (EC) {
+      err = EC.message();
+      return nullptr;
+    }
+  }
+
+  switch (format) {
+  case REPORT_TEXT:
+    return std::unique_ptr<ReportSink>(new TextSink(std::move(file)));
+  case REPORT_JSONL:
+    return std::unique_ptr<ReportSink>(new JSONLinesSink(std::move(file)));
+  case REPORT_SARIF:
+    return std::unique_ptr<ReportSink>(new SARIFSink(std::move(file)));
+  }
+  llvm_unreachable("Invalid report format");
+}
+
+void ReportSink::emit(const Report &R) {
+  // The first report has to go out first (SARIF separates the rest by
+  // commas), so only it is formatted under the lock.
+  std::unique_lock<std::mutex> guard(lock);
+  if (first) {
+    OS << format(R, true);
+    first = false;
+    return;
+  }
+  guard.unlock();
+
+  auto str = format(R, false);
+  guard.lock();
+  OS << str;
+}
+
+void ReportSink::finish() {
+  std::lock_guard<std::mutex> guard(lock);
+  OS.flush();
+}
+
+const char *ReportSink::getKindName(KINT_TYPE kind) {
+  switch (kind) {
+  case KINT_OVERFLOW:
+    return "overflow";
+  case KINT_SHIFT_DIV:
+    return "shift-div";
+  case KINT_NONE:
+    break;
+  }
+  return "none";
+}
@@ -0,0 +1,70 @@
+#ifndef REPORTSINK_H
+#define REPORTSINK_H
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "KintChecks.h"
+
+// One finding of -kint-smt-query.
+struct Report {
+  std::string module;
+  std::string function;
+  std::string block;
+  // The guarded instruction, as printed by LLVM
+  std::string inst;
+  // From the instruction's DebugLoc, empty/0 without debug info
+  std::string file;
+  unsigned line = 0;
+  unsigned column = 0;
+  KINT_TYPE kind = KINT_NONE;
+  std::string verdict = "sat";
+  double seconds = 0;
+  // Profile count of the block of the instruction, -1 if not looked up
+  int64_t count = -1;
+  // Concrete (name, value) inputs triggering the error, if known
+  llvm::SmallVector<std::pair<std::string, std::string>, 4> witness;
+};
+
+enum ReportFormat {
+  REPORT_TEXT,
+  REPORT_JSONL,
+  REPORT_SARIF,
+};
+
+// Where reports go. Every format writes through a buffered stream, and
+// emit() may be called from several threads at once.
+class ReportSink {
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  std::mutex lock;
+  bool first = true;
+
+protected:
+  llvm::raw_fd_ostream &OS;
+
+  explicit ReportSink(std::unique_ptr<llvm::raw_fd_ostream> file) :
+    file(std::move(file)), OS(*this->file) {}
+
+  // Serialize one report, without holding the lock
+  virtual std::string format(const Report &, bool first) = 0;
+
+public:
+  virtual ~ReportSink() = default;
+
+  // Writes to path, or to stderr if it is empty. Returns null and sets err
+  // if the file cannot be opened.
+  static std::unique_ptr<ReportSink> create(ReportFormat, llvm::StringRef path,
+                                            std::string &err);
+
+  void emit(const Report &);
+  // Complete the output; nothing may be emitted afterwards.
+  virtual void finish();
+
+  static const char *getKindName(KINT_TYPE);
+};
+
+#endif /* REPORTSINK_H */
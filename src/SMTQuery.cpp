@@ -1,41 +1,360 @@
-#define DEBUG_TYPE "kint"
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
 #include <llvm/Analysis/CFG.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
+#include "CheckSampler.h"
+#include "ConcreteEval.h"
 #include "Constraints.h"
+#include "KintChecks.h"
+#include "MemoryStats.h"
+#include "PersistentState.h"
+#include "QueryCache.h"
+#include "ReportSink.h"
+#include "SolverPool.h"
 #include "SMTSolver.h"
 
+#define DEBUG_TYPE "kint"
+
 using namespace llvm;
 
+static cl::opt<bool> StrengthenIR("kint-strengthen-ir",
+  cl::desc("Write nuw/nsw/exact flags and divisor assumptions proven by the "
+           "solver back into the IR, then drop the inserted checks"),
+  cl::init(false));
+
+static cl::list<std::string> Portfolio("kint-portfolio", cl::CommaSeparated,
+  cl::desc("Race these Boolector configurations (<engine>[:rw<level>], engine "
+           "one of fun, prop, sls, aigprop) on every query"),
+  cl::value_desc("config,..."));
+
+static cl::opt<unsigned> AbstractNonlinear("kint-abstract-nonlinear",
+  cl::desc("Solve mul/div/rem (and multiplication overflow) of at least this "
+           "many bits by abstraction refinement (0 = exact encoding)"),
+  cl::value_desc("width"), cl::init(0));
+
+static cl::opt<unsigned> NarrowWidth("kint-narrow-width",
+  cl::desc("First solve each query with free variables restricted to this "
+           "many sign-extended bits, falling back to full width on UNSAT "
+           "(0 = always full width)"),
+  cl::value_desc("bits"), cl::init(0));
+
+static cl::opt<unsigned> CallSummaries("kint-call-summaries",
+  cl::desc("Encode the results of calls to small loop-free functions from "
+           "a summary of their return value computed once per module, nesting "
+           "up to this many calls deep (0 = treat every call result as unknown)"),
+  cl::value_desc("depth"), cl::init(0));
+
+static cl::list<std::string> SummaryIndexFiles("kint-summary-index", cl::CommaSeparated,
+  cl::desc("Merge these -kint-summary-emit outputs, covering the whole "
+           "program, and bound call results and arguments by them"),
+  cl::value_desc("file,..."));
+
+static cl::opt<unsigned> SummaryMaxInsts("kint-summary-max-insts",
+  cl::desc("Largest function, in instructions, to summarize for "
+           "-kint-call-summaries"),
+  cl::value_desc("n"), cl::init(200));
+
+static cl::opt<ReportFormat> ReportFormatOpt("kint-report-format",
+  cl::desc("Format of the reports"),
+  cl::values(clEnumValN(REPORT_TEXT, "text", "One line of text per report (default)"),
+             clEnumValN(REPORT_JSONL, "jsonl", "One JSON object per line"),
+             clEnumValN(REPORT_SARIF, "sarif", "A SARIF 2.1.0 log")),
+  cl::init(REPORT_TEXT));
+
+static cl::opt<std::string> ReportFile("kint-report-file",
+  cl::desc("Write reports to this file instead of stderr"),
+  cl::value_desc("file"), cl::init(""));
+
+enum DedupPolicy {
+  DEDUP_OFF,
+  DEDUP_LOC,
+  DEDUP_INLINED,
+};
+
+static cl::opt<DedupPolicy> Dedup("kint-dedup",
+  cl::desc("Once a check is reported, skip the other checks of the module "
+           "guarding the same source-level operation"),
+  cl::values(clEnumValN(DEDUP_OFF, "off", "Solve every check (default)"),
+             clEnumValN(DEDUP_LOC, "loc",
+                        "Same debug location, wherever it was inlined to"),
+             clEnumValN(DEDUP_INLINED, "inlined",
+                        "Same debug location and inlined-at chain, i.e. "
+                        "copies made by cloning such as loop unswitching")),
+  cl::init(DEDUP_OFF));
+
+static cl::opt<bool> Witness("kint-witness",
+  cl::desc("Re-solve every reported check with model generation and attach "
+           "the function arguments triggering it to the report"),
+  cl::init(false));
+
+static cl::opt<bool> ModelGen("kint-model-gen",
+  cl::desc("Enable model generation for every query, not just the ones that "
+           "read the model (for comparing solve times)"),
+  cl::init(false));
+
+static cl::opt<unsigned> ConcreteBatches("kint-concrete-batches",
+  cl::desc("Before solving, evaluate the checks of each function on this "
+           "many batches of 64 boundary and random inputs, and report the "
+           "ones that fail without asking the solver (0 = off)"),
+  cl::value_desc("n"), cl::init(0));
+
+static cl::opt<bool> QueryCacheOpt("kint-query-cache",
+  cl::desc("Answer queries from the models and UNSAT cores of earlier ones "
+           "where possible"),
+  cl::init(false));
+
+static cl::opt<bool> Simplify("kint-simplify",
+  cl::desc("Simplify queries before handing them to the solver, eliminating "
+           "variables defined by asserted equalities"),
+  cl::init(false));
+
+static cl::opt<unsigned> Workers("kint-workers",
+  cl::desc("Solve queries in this many forked worker processes, so that a "
+           "solver crash or blow-up only loses its query (0 = in process)"),
+  cl::value_desc("n"), cl::init(0));
+
+static cl::opt<unsigned> WorkerMemory("kint-worker-memory",
+  cl::desc("Memory a solver worker may allocate, in MB (0 = unlimited)"),
+  cl::value_desc("MB"), cl::init(4096));
+
+static cl::opt<unsigned> WorkerTimeout("kint-worker-timeout",
+  cl::desc("Kill a solver worker after this many seconds on one query "
+           "(0 = never)"),
+  cl::value_desc("seconds"), cl::init(0));
+
+static cl::opt<unsigned> WorkerQueries("kint-worker-queries",
+  cl::desc("Replace a solver worker after this many queries (0 = never)"),
+  cl::value_desc("n"), cl::init(1000));
+
+static cl::opt<unsigned> SolverMaxNodes("kint-solver-max-nodes",
+  cl::desc("Rebuild a solver holding more than this many Boolector nodes "
+           "before its next check, keeping only its assertions (0 = never)"),
+  cl::value_desc("n"), cl::init(1000000));
+
+static cl::opt<bool> MemoryStatsOpt("kint-memory-stats",
+  cl::desc("Print the functions with the highest peak resident set and "
+           "solver node count"),
+  cl::init(false));
+
+static cl::opt<std::string> SlowQueryDir("kint-slow-query-dir",
+  cl::desc("Write every query slower than -kint-slow-query-ms to this "
+           "directory, as an SMT-LIB2 file"),
+  cl::value_desc("dir"));
+
+static cl::opt<unsigned> SlowQueryMs("kint-slow-query-ms",
+  cl::desc("Time from which a query is written to -kint-slow-query-dir"),
+  cl::value_desc("ms"), cl::init(1000));
+
+static cl::opt<bool> CheapestFirst("kint-cheapest-first",
+  cl::desc("Solve the queries of a function in order of their estimated "
+           "cost, from their size, bit width and operators"),
+  cl::init(false));
+
+static cl::opt<unsigned> FunctionDeadline("kint-function-deadline",
+  cl::desc("Give up on the queries of a function still unsolved after this "
+           "many seconds, reporting them as unknown (0 = never)"),
+  cl::value_desc("seconds"), cl::init(0));
+
+static cl::opt<std::string> CostLog("kint-cost-log",
+  cl::desc("Write the estimated cost of every solved query next to its "
+           "solve time to this file, tab-separated"),
+  cl::value_desc("file"));
+
+static cl::opt<bool> TaintedFirst("kint-tainted-first",
+  cl::desc("Solve the checks marked by -kint-taint first, those reaching a "
+           "sink before the others"),
+  cl::init(false));
+
+static cl::opt<bool> TaintedOnly("kint-tainted-only",
+  cl::desc("Only solve the checks marked by -kint-taint"),
+  cl::init(false));
+
+static cl::opt<bool> HotFirst("kint-hot-first",
+  cl::desc("Analyze functions in order of their profile entry count, and "
+           "the checks of a function in order of their block's count"),
+  cl::init(false));
+
+static cl::opt<unsigned long long> MinHotness("kint-min-hotness",
+  cl::desc("Skip checks whose block has a lower profile count, reporting "
+           "them as cold (0 = analyze everything)"),
+  cl::value_desc("count"), cl::init(0));
+
+static cl::opt<unsigned> TimeBudget("kint-time-budget",
+  cl::desc("Give up on the queries of the module still unsolved after this "
+           "many seconds, reporting them as unknown (0 = never)"),
+  cl::value_desc("seconds"), cl::init(0));
+
+static cl::opt<double> SampleRate("kint-sample",
+  cl::desc("Only solve a stratified random sample of this fraction of the "
+           "checks, and estimate the results of a full run (0 = solve all)"),
+  cl::value_desc("fraction"), cl::init(0));
+
+static cl::opt<unsigned> SampleSeed("kint-sample-seed",
+  cl::desc("Seed of the random sample drawn by -kint-sample"),
+  cl::value_desc("n"), cl::init(1));
+
+static cl::opt<bool> Persist("kint-persist",
+  cl::desc("Keep the solver workers, the loaded summary indexes and the "
+           "verdicts of plain queries for the next module analyzed by the "
+           "same process, as kint-server does"),
+  cl::init(false));
+
+static cl::opt<unsigned> PersistVerdicts("kint-persist-verdicts",
+  cl::desc("Most query verdicts kept by -kint-persist; the cache starts over "
+           "once full"),
+  cl::value_desc("n"), cl::init(1 << 20));
+
+// Options every solver of the pass shares
+static void setSolverOptions(SMTConfig &config) {
+  config.simplify = Simplify;
+  config.maxNodes = SolverMaxNodes;
+}
+
+STATISTIC(NumCacheLookups, "Number of queries looked up in the query cache");
+STATISTIC(NumCexHits,  "Number of queries answered SAT by a cached counterexample");
+STATISTIC(NumCoreHits, "Number of queries answered UNSAT by a cached UNSAT core");
+STATISTIC(NumCoresLearned, "Number of UNSAT cores added to the query cache");
+STATISTIC(NumConcreteSat, "Number of checks shown to fail by concrete evaluation");
+STATISTIC(NumWitnesses, "Number of witnesses generated for reports");
+STATISTIC(NumSlowQueries, "Number of slow queries written to -kint-slow-query-dir");
+STATISTIC(MaxFunctionRSS, "Highest peak resident set while analyzing one function, in MB");
+STATISTIC(NumUnknown, "Number of queries left unsolved by a lost solver worker or the deadline");
+STATISTIC(NumUntaintedSkipped, "Number of untainted queries skipped by -kint-tainted-only");
+STATISTIC(NumUntaintedGates, "Estimated gates of the untainted queries skipped");
+STATISTIC(NumColdSkipped, "Number of queries skipped below -kint-min-hotness");
+STATISTIC(NumPastDeadline, "Number of queries given up at the function deadline");
+STATISTIC(NumDedupSkipped, "Number of queries skipped, their source location already reported");
+STATISTIC(NumNarrowSat,      "Number of queries answered SAT at narrow width");
+STATISTIC(NumNarrowFallback, "Number of queries re-solved at full width");
+STATISTIC(NumRefinementRounds, "Number of abstraction refinement rounds");
+STATISTIC(NumNUW,    "Number of nuw flags proven");
+STATISTIC(NumNSW,    "Number of nsw flags proven");
+STATISTIC(NumExact,  "Number of exact flags proven");
+STATISTIC(NumAssume, "Number of non-zero divisor assumptions inserted");
+
 namespace {
 
 struct SMTQuery : public FunctionPass {
   static char ID; // Pass identification
   SMTQuery() : FunctionPass(ID) {}
 
+  bool doInitialization(Module &);
   bool runOnFunction(Function &);
+  bool doFinalization(Module &);
 
   // getAnalysisUsage - List passes required by this pass.  We also know it
   // will not alter the CFG, so say so.
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    if (HotFirst || MinHotness)
+      AU.addRequired<BlockFrequencyInfoWrapperPass>();
     AU.setPreservesCFG();
   }
 
 private:
-  enum KINT_TYPE : unsigned {
-    KINT_NONE = 0,
-    KINT_OVERFLOW = 1,
-    KINT_SHIFT_DIV = 2,
+  SmallPtrSet<CallInst *, 32> reports;
+  CheckedInstFinder checkedInsts;
+  std::vector<SMTConfig> portfolio;
+  SummaryCache summaries;
+  SummaryIndex index;
+  std::unique_ptr<ReportSink> sink;
+  // See -kint-workers
+  std::unique_ptr<SolverPool> pool;
+  // Where pool and index came from, see -kint-persist
+  std::string poolKey, indexKey;
+
+  // (scope, line, column, inlined-at, opcode, check) of a source operation
+  typedef std::tuple<const DIScope *, unsigned, unsigned, const DILocation *,
+                     unsigned, KINT_TYPE> SiteKey;
+  // Source operations of the module already reported, see -kint-dedup
+  std::set<SiteKey> reportedSites;
+  // See -kint-memory-stats
+  MemoryStats memoryStats;
+  // Checks of the current function failing on concrete inputs, with the
+  // arguments of one such input
+  DenseMap<CallInst *, SmallVector<std::pair<std::string, std::string>, 4>> concreteSat;
+  // See -kint-query-cache. The evaluator tries the cached counterexamples
+  // on the current function, one per lane, and is rebuilt whenever they
+  // change.
+  std::unique_ptr<QueryCache> cache;
+  std::unique_ptr<ConcreteEvaluator> cexEval;
+  unsigned cexLanes = 0;
+  bool cexStale = true;
+  // Estimated cost of the query of every check of the current function,
+  // see -kint-cheapest-first and -kint-cost-log
+  DenseMap<CallInst *, SMTCost> costs;
+  std::unique_ptr<raw_fd_ostream> costLog;
+  // See -kint-function-deadline and -kint-time-budget
+  std::chrono::steady_clock::time_point deadline, budgetEnd;
+  // Profile count of the block of every check of the current function,
+  // see -kint-hot-first and -kint-min-hotness
+  DenseMap<CallInst *, uint64_t> siteCounts;
+  // See -kint-sample
+  std::unique_ptr<CheckSampler> sampler;
+  // Functions left for doFinalization() by -kint-hot-first, with their back
+  // edges and checks
+  struct PendingFunction {
+    Function *F;
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 16> backEdges;
+    SmallVector<std::pair<CallInst *, KINT_TYPE>, 32> checks;
   };
+  std::vector<PendingFunction> pendingFunctions;
 
-  SmallPtrSet<CallInst *, 32> reports;
+  typedef ArrayRef<std::pair<const BasicBlock *, const BasicBlock *>> BackEdges;
 
-  void doCheck(CallInst *, ArrayRef<std::pair<const BasicBlock *, const BasicBlock *>>, KINT_TYPE);
+  void setUp(ValueConstraint &);
+  void startChecks(Function &, BackEdges, ArrayRef<std::pair<CallInst *, KINT_TYPE>>);
+  void evalConcrete(Function &, BackEdges, ArrayRef<std::pair<CallInst *, KINT_TYPE>>);
+  void estimateCosts(ArrayRef<std::pair<CallInst *, KINT_TYPE>>, BackEdges);
+  void logCost(CallInst *, KINT_TYPE, StringRef verdict, double seconds);
+  SolveResult doCheck(CallInst *, BackEdges, KINT_TYPE);
+  void doChecksInWorkers(ArrayRef<std::pair<CallInst *, KINT_TYPE>>, BackEdges);
+  void addReport(CallInst *, BackEdges, KINT_TYPE, StringRef verdict, double seconds);
+  static bool lookupVerdict(SMTExpr, std::string &key, bool &sat);
+  static void storeVerdict(StringRef key, bool sat);
+  bool tryCounterexamples(CallInst *, BackEdges, KINT_TYPE);
+  void addAssignment(SMTSolver &, ValueConstraint &, Function *);
+  void addCore(SMTSolver &, const QueryCache::QueryKeys &, ArrayRef<SMTExpr> parts);
+  static SMTExpr buildQuery(ValueConstraint &, CallInst *, BackEdges, KINT_TYPE,
+                            const QueryCache::QueryKeys *keys = nullptr,
+                            SmallVectorImpl<SMTExpr> *parts = nullptr);
+  static bool solveRefined(SMTSolver &, ValueConstraint &, SMTExpr,
+                           ArrayRef<SMTExpr> assumptions = None);
+  static bool solve(SMTSolver &, ValueConstraint &, SMTExpr);
+  bool solveTiered(CallInst *, BackEdges, KINT_TYPE, const QueryCache::QueryKeys *);
+  bool strengthen(CallInst *, BackEdges);
+  bool isImpossible(CallInst *, BackEdges,
+                    function_ref<SMTExpr(SMTSolver &, ValueConstraint &)>);
 
-  static KINT_TYPE matchKintFunc(const Function *);
-  static void printReport(const CallInst *);
+  void printReport(CallInst *, BackEdges, KINT_TYPE, StringRef verdict, double seconds);
+  void captureQuery(CallInst *, BackEdges, KINT_TYPE, StringRef verdict, double seconds);
+  void describeCheck(CallInst *, KINT_TYPE, Report &);
+  void findWitness(CallInst *, BackEdges, KINT_TYPE, Report &);
+  bool getSiteKey(CallInst *, KINT_TYPE, SiteKey &);
+  static void sortByCost(MutableArrayRef<std::pair<CallInst *, KINT_TYPE>>);
+  // 0 for tainted checks reaching a sink, 1 for other tainted ones, 2 for
+  // the rest
+  static unsigned getTaintRank(CallInst *CI) {
+    return CI->getMetadata(KINT_SINK_MD) ? 0 : CI->getMetadata(KINT_TAINT_MD) ? 1 : 2;
+  }
 };
 
 } // End anonymous namespace
@@ -47,56 +366,851 @@ static RegisterPass<SMTQuery> X("kint-smt-query",
           false /* does not modify the CFG */,
           false /* transformation, not just analysis */);
 
-SMTQuery::KINT_TYPE SMTQuery::matchKintFunc(const Function *F) {
-  auto name = static_cast<std::string>(F->getName());
-  if (name.compare(0, 15, "__kint_overflow") == 0)
-    return KINT_OVERFLOW;
-  else if (name.compare(0, 16, "__kint_shift_div") == 0)
-    return KINT_SHIFT_DIV;
-  else
-    return KINT_NONE;
+// Where the check is, and what it checks
+void SMTQuery::describeCheck(CallInst *CI, KINT_TYPE type, Report &R) {
+  auto *I = checkedInsts.get(CI);
+  R.module = I->getModule()->getName().str();
+  R.function = I->getFunction()->getName().str();
+  R.block = I->getParent()->getName().str();
+  raw_string_ostream(R.inst) << *I;
+  if (auto &Loc = I->getDebugLoc()) {
+    R.file = Loc->getFilename().str();
+    R.line = Loc.getLine();
+    R.column = Loc.getCol();
+  }
+  R.kind = type;
+}
+
+void SMTQuery::printReport(CallInst *CI, BackEdges backEdges, KINT_TYPE type,
+                           StringRef verdict, double seconds) {
+  Report R;
+  describeCheck(CI, type, R);
+  R.verdict = verdict.str();
+  R.seconds = seconds;
+  auto it = siteCounts.find(CI);
+  if (it != siteCounts.end())
+    R.count = it->second;
+  if (Witness && verdict == "sat")
+    findWitness(CI, backEdges, type, R);
+
+  sink->emit(R);
 }
 
-void SMTQuery::printReport(const CallInst *CI) {
-  auto *I = CI->getNextNode();
+// Queries are solved without model generation, as almost all of them are
+// UNSAT and the model of the rest is only wanted for the report. Pay for
+// it here, once per report, with the exact encoding.
+void SMTQuery::findWitness(CallInst *CI, BackEdges backEdges, KINT_TYPE type, Report &R) {
+  auto it = concreteSat.find(CI);
+  if (it != concreteSat.end() && !it->second.empty()) {
+    R.witness = it->second;
+    ++NumWitnesses;
+    return;
+  }
 
-  errs() << "Possible Integer error: " << I->getModule()->getName() << "::"
-    << I->getFunction()->getName();
+  SMTConfig config;
+  config.modelGen = true;
+  setSolverOptions(config);
+  SMTSolver solver(config);
+  ValueConstraint ValCon(solver, CI->getModule()->getDataLayout());
+  setUp(ValCon);
 
-  auto BBName = I->getParent()->getName();
-  if (BBName != "")
-    errs() << "::" << BBName;
+  if (!solver.smt_query(buildQuery(ValCon, CI, backEdges, type)))
+    return;
 
-  errs() << ": " << *I << '\n';
+  for (auto &A: CI->getFunction()->args()) {
+    auto expr = ValCon.valueToExpr.lookup(&A);
+    if (!expr)
+      continue;
+    auto name = A.hasName() ? A.getName().str() : "arg" + std::to_string(A.getArgNo());
+    auto val = solver.smt_assignment(expr);
+    auto numLanes = ValueConstraint::getNumLanes(A.getType());
+    if (numLanes == 1) {
+      R.witness.emplace_back(name, toString(val, 10, val.getBitWidth() > 1));
+      continue;
+    }
+    // Lane 0 first, as LLVM writes vector constants
+    auto laneWidth = val.getBitWidth() / numLanes;
+    std::string lanes = "<";
+    for (unsigned i = 0; i < numLanes; ++i) {
+      auto lane = val.extractBits(laneWidth, i * laneWidth);
+      lanes += (i ? ", " : "") + toString(lane, 10, laneWidth > 1);
+    }
+    R.witness.emplace_back(name, lanes + ">");
+  }
+  ++NumWitnesses;
 }
 
 bool SMTQuery::runOnFunction(Function &F) {
   SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 16> backEdges;
+  SmallVector<std::pair<CallInst *, KINT_TYPE>, 32> checks, untainted, cold;
+  bool trackMemory = MemoryStatsOpt || AreStatisticsEnabled();
+  // Module passes only run after our doInitialization().
+  if ((TaintedFirst || TaintedOnly) && !F.getParent()->getNamedMetadata(KINT_TAINT_MD))
+    report_fatal_error("-kint-tainted-first and -kint-tainted-only need -kint-taint "
+                       "to run first", false);
+  if (trackMemory)
+    MemoryStats::start();
   FindFunctionBackedges(F, backEdges);
   reports.clear();
+  checkedInsts.reset();
+
+  // Reports of pending functions still need theirs.
+  if (!HotFirst)
+    siteCounts.clear();
+  BlockFrequencyInfo *BFI = nullptr;
+  if (HotFirst || MinHotness)
+    BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
 
   for (auto &BB: F) {
     for (auto &I: BB) {
-      auto *CI = dyn_cast<CallInst>(&I);
-      if (!CI)
-        continue;
-
-      auto type = matchKintFunc(CI->getCalledFunction());
+      auto type = matchKintCheck(&I);
       if (!type)
         continue;
 
-      doCheck(CI, backEdges, type);
+      // Code without a profile is taken to never run.
+      auto *CI = cast<CallInst>(&I);
+      if (BFI)
+        siteCounts[CI] = BFI->getBlockProfileCount(checkedInsts.get(CI)->getParent()).getValueOr(0);
+
+      if (TaintedOnly && !CI->getMetadata(KINT_TAINT_MD))
+        untainted.emplace_back(CI, type);
+      else if (MinHotness && siteCounts[CI] < MinHotness)
+        cold.emplace_back(CI, type);
+      else
+        checks.emplace_back(CI, type);
+    }
+  }
+
+  if (Dedup != DEDUP_OFF)
+    sortByCost(checks);
+
+  // One expensive query early in the function must not hold up the cheap
+  // ones behind it until the deadline.
+  costs.clear();
+  if (CheapestFirst || costLog)
+    estimateCosts(checks, backEdges);
+  if (CheapestFirst) {
+    std::stable_sort(checks.begin(), checks.end(),
+                     [&](const std::pair<CallInst *, KINT_TYPE> &a,
+                         const std::pair<CallInst *, KINT_TYPE> &b) {
+                       return costs[a.first].gates < costs[b.first].gates;
+                     });
+  }
+  if (HotFirst) {
+    std::stable_sort(checks.begin(), checks.end(),
+                     [&](const std::pair<CallInst *, KINT_TYPE> &a,
+                         const std::pair<CallInst *, KINT_TYPE> &b) {
+                       return siteCounts[a.first] > siteCounts[b.first];
+                     });
+  }
+  if (TaintedFirst) {
+    std::stable_sort(checks.begin(), checks.end(),
+                     [](const std::pair<CallInst *, KINT_TYPE> &a,
+                        const std::pair<CallInst *, KINT_TYPE> &b) {
+                       return getTaintRank(a.first) < getTaintRank(b.first);
+                     });
+  }
+
+  // Cold checks are not solved, but the report says where they are.
+  NumColdSkipped += cold.size();
+  for (auto &C: cold)
+    addReport(C.first, backEdges, C.second, "cold", 0);
+
+  NumUntaintedSkipped += untainted.size();
+  if (AreStatisticsEnabled() && !untainted.empty()) {
+    estimateCosts(untainted, backEdges);
+    for (auto &C: untainted)
+      NumUntaintedGates += costs[C.first].gates;
+  }
+
+  // Which checks get solved is only decided once all are known.
+  if (sampler) {
+    sampler->add(F, backEdges, checks);
+    return false;
+  }
+
+  // Functions are solved in order of their entry count once all are known.
+  if (HotFirst) {
+    pendingFunctions.push_back(PendingFunction{ &F, { backEdges.begin(), backEdges.end() },
+                                                { checks.begin(), checks.end() } });
+    return false;
+  }
+
+  startChecks(F, backEdges, checks);
+  bool Changed = false;
+
+  if (pool)
+    doChecksInWorkers(checks, backEdges);
+
+  for (auto &C: checks) {
+    if (!pool)
+      doCheck(C.first, backEdges, C.second);
+    if (StrengthenIR && std::chrono::steady_clock::now() < deadline)
+      Changed |= strengthen(C.first, backEdges);
+  }
+
+  // The checks only exist to be queried; once their facts are in the IR they
+  // would just get in the way of the optimizer.
+  if (StrengthenIR) {
+    for (auto &C: concat<std::pair<CallInst *, KINT_TYPE>>(checks, untainted, cold)) {
+      SmallVector<Value *, 4> args(C.first->args());
+      C.first->eraseFromParent();
+      for (auto *V: args)
+        RecursivelyDeleteTriviallyDeadInstructions(V);
     }
+    Changed |= !checks.empty() || !untainted.empty() || !cold.empty();
+  }
+
+  // Solvers of worker processes count toward the workers, not us.
+  if (trackMemory)
+    MaxFunctionRSS.updateMax(memoryStats.finish(F.getName()) >> 10);
+
+  return Changed;
+}
+
+bool SMTQuery::doInitialization(Module &M) {
+  std::string err;
+  checkedInsts.reset();
+  sink = ReportSink::create(ReportFormatOpt, ReportFile, err);
+  if (!sink)
+    report_fatal_error(Twine("cannot write reports to '") + ReportFile + "': " + err, false);
+
+  // Block counts follow from entry counts; without any, every block counts
+  // as never run.
+  if (MinHotness && none_of(M, [](const Function &F) { return F.getEntryCount().hasValue(); }))
+    errs() << "kint: warning: " << M.getModuleIdentifier() << " has no profile data, so "
+           << "-kint-min-hotness skips every check as cold\n";
+
+  budgetEnd = std::chrono::steady_clock::time_point::max();
+  if (TimeBudget)
+    budgetEnd = std::chrono::steady_clock::now() + std::chrono::seconds(TimeBudget);
+
+  summaries.reset(SummaryMaxInsts);
+  reportedSites.clear();
+  memoryStats.clear();
+  costLog.reset();
+  if (!CostLog.empty()) {
+    std::error_code EC;
+    costLog.reset(new raw_fd_ostream(CostLog, EC, sys::fs::OF_Text));
+    if (EC)
+      report_fatal_error(Twine("cannot write the cost log '") + CostLog + "': " + EC.message(), false);
+    *costLog << "function\tblock\tlocation\tcheck\tnodes\twidth\tnonlinear\tcost\tseconds\tverdict\n";
+  }
+  if (!SlowQueryDir.empty()) {
+    if (auto EC = sys::fs::create_directories(SlowQueryDir))
+      report_fatal_error(Twine("cannot create '") + SlowQueryDir + "': " + EC.message(), false);
+  }
+  // A kept index is only reused while none of its files changed.
+  auto &state = PersistentState::get();
+  indexKey.clear();
+  for (auto &path: SummaryIndexFiles) {
+    sys::fs::file_status status;
+    indexKey += path;
+    if (!sys::fs::status(path, status))
+      indexKey += ":" + std::to_string(status.getLastModificationTime().time_since_epoch().count());
+    indexKey += '\n';
+  }
+  if (Persist && !indexKey.empty() && state.indexKey == indexKey) {
+    index = std::move(state.index);
+  } else {
+    index = SummaryIndex();
+    for (auto &path: SummaryIndexFiles) {
+      if (!index.load(path, err))
+        report_fatal_error(Twine("cannot read summary index '") + path + "': " + err, false);
+    }
+  }
+  state.index = SummaryIndex();
+  state.indexKey.clear();
+
+  portfolio.clear();
+  for (auto &str: Portfolio) {
+    SMTConfig config;
+    if (!SMTConfig::parse(str, config))
+      report_fatal_error(Twine("invalid -kint-portfolio configuration '") + str + "'", false);
+    portfolio.push_back(config);
   }
 
+  // Without a complete engine in the race, UNSAT queries would never finish.
+  if (!portfolio.empty() &&
+      std::none_of(portfolio.begin(), portfolio.end(),
+                   [](const SMTConfig &C) { return C.isComplete(); }))
+    portfolio.push_back(SMTConfig());
+
+  // The racing solvers only answer the plain query.
+  if (!portfolio.empty() && (NarrowWidth || AbstractNonlinear || QueryCacheOpt))
+    report_fatal_error("-kint-portfolio cannot be combined with -kint-narrow-width, "
+                       "-kint-abstract-nonlinear or -kint-query-cache", false);
+
+  for (auto &config: portfolio) {
+    config.modelGen = ModelGen;
+    setSolverOptions(config);
+  }
+
+  cache.reset(QueryCacheOpt ? new QueryCache(ConcreteEvaluator::Lanes) : nullptr);
+  cexEval.reset();
+
+  // Workers only answer SAT or UNSAT, with no model or core to refine or
+  // learn from.
+  pool.reset();
+  if (SampleRate < 0 || SampleRate > 1)
+    report_fatal_error("-kint-sample takes a fraction between 0 and 1", false);
+  // The sample is only solved once every function has been visited.
+  if (SampleRate > 0 && (Workers || StrengthenIR))
+    report_fatal_error("-kint-sample cannot be combined with -kint-workers or "
+                       "-kint-strengthen-ir", false);
+  // So are the checks of -kint-hot-first, too late to change the IR, and
+  // the sample would be solved in module order regardless.
+  if (HotFirst && (StrengthenIR || SampleRate > 0))
+    report_fatal_error("-kint-hot-first cannot be combined with -kint-strengthen-ir "
+                       "or -kint-sample", false);
+  sampler.reset(SampleRate > 0 ? new CheckSampler(SampleRate, SampleSeed) : nullptr);
+  if (Workers) {
+    if (!portfolio.empty() || NarrowWidth || AbstractNonlinear || cache)
+      report_fatal_error("-kint-workers cannot be combined with -kint-portfolio, "
+                         "-kint-narrow-width, -kint-abstract-nonlinear or "
+                         "-kint-query-cache", false);
+    SMTConfig config;
+    setSolverOptions(config);
+    poolKey = (Twine(Workers) + "/" + Twine(WorkerMemory) + "/" + Twine(WorkerTimeout) + "/" +
+               Twine(WorkerQueries) + "/" + Twine(unsigned(config.simplify)) + "/" +
+               Twine(config.maxNodes)).str();
+    if (!Persist || state.poolKey != poolKey)
+      state.pool.reset();
+    pool = std::move(state.pool);
+    if (!pool)
+      pool.reset(new SolverPool(Workers, config, WorkerMemory, WorkerTimeout, WorkerQueries));
+  }
+
+  return false;
+}
+
+bool SMTQuery::doFinalization(Module &M) {
+  // Printed once the reports of the sample are out
+  std::string estimate;
+  if (sampler) {
+    raw_string_ostream OS(estimate);
+    sampler->solve(OS,
+      [&](Function &F, BackEdges backEdges, ArrayRef<std::pair<CallInst *, KINT_TYPE>> checks) {
+        reports.clear();
+        costs.clear();
+        if (costLog)
+          estimateCosts(checks, backEdges);
+        startChecks(F, backEdges, checks);
+      },
+      [&](CallInst *CI, BackEdges backEdges, KINT_TYPE type) {
+        return doCheck(CI, backEdges, type);
+      });
+    sampler.reset();
+  }
+  // Sorting the module instead would reorder its output as well.
+  if (HotFirst) {
+    auto getEntryCount = [](const Function *F) -> uint64_t {
+      auto count = F->getEntryCount();
+      return count ? count->getCount() : 0;
+    };
+    std::stable_sort(pendingFunctions.begin(), pendingFunctions.end(),
+                     [&](const PendingFunction &A, const PendingFunction &B) {
+                       return getEntryCount(A.F) > getEntryCount(B.F);
+                     });
+    bool trackMemory = MemoryStatsOpt || AreStatisticsEnabled();
+    for (auto &P: pendingFunctions) {
+      if (trackMemory)
+        MemoryStats::start();
+      reports.clear();
+      costs.clear();
+      if (costLog)
+        estimateCosts(P.checks, P.backEdges);
+      startChecks(*P.F, P.backEdges, P.checks);
+      if (pool)
+        doChecksInWorkers(P.checks, P.backEdges);
+      else
+        for (auto &C: P.checks)
+          doCheck(C.first, P.backEdges, C.second);
+      if (trackMemory)
+        MaxFunctionRSS.updateMax(memoryStats.finish(P.F->getName()) >> 10);
+    }
+    pendingFunctions.clear();
+    siteCounts.clear();
+  }
+  if (Persist) {
+    auto &state = PersistentState::get();
+    if (pool) {
+      state.pool = std::move(pool);
+      state.poolKey = poolKey;
+    }
+    state.index = std::move(index);
+    state.indexKey = indexKey;
+  }
+  pool.reset();
+  sink->finish();
+  sink.reset();
+  costLog.reset();
+  errs() << estimate;
+  SMTSolver::smt_print_portfolio_stats(errs());
+  if (MemoryStatsOpt)
+    memoryStats.print(errs());
   return false;
 }
 
-void SMTQuery::doCheck(CallInst *CI,
-  ArrayRef<std::pair<const BasicBlock *, const BasicBlock *>> backEdges, KINT_TYPE type) {
+// Many checks fail on the first input that reaches them; finding those by
+// evaluation is far cheaper than bit-blasting their queries.
+void SMTQuery::evalConcrete(Function &F, BackEdges backEdges,
+                            ArrayRef<std::pair<CallInst *, KINT_TYPE>> checks) {
+  ConcreteEvaluator Eval(F, F.getParent()->getDataLayout(), backEdges);
+  Eval.setSummaries(&summaries, CallSummaries);
+  Eval.setSummaryIndex(&index);
+
+  for (unsigned batch = 0; batch < ConcreteBatches; ++batch) {
+    Eval.startBatch(batch);
+    bool pending = false;
+
+    for (auto &C: checks) {
+      if (concreteSat.count(C.first))
+        continue;
+      auto lanes = Eval.evalCheck(C.first, C.second);
+      if (!lanes) {
+        pending = true;
+        continue;
+      }
+      Eval.getArgWitness(countTrailingZeros(lanes), concreteSat[C.first]);
+      if (cache) {
+        QueryCache::Assignment values;
+        Eval.getLeafValues(countTrailingZeros(lanes), values);
+        cache->addAssignment(&F, std::move(values));
+        cexStale = true;
+      }
+    }
+
+    if (!pending)
+      break;
+  }
+}
+
+// Interprocedural facts. Argument ranges from the index assume it saw every
+// caller; isImpossible() turns them off.
+void SMTQuery::setUp(ValueConstraint &ValCon) {
+  ValCon.setSummaries(&summaries, CallSummaries);
+  ValCon.setSummaryIndex(&index);
+}
+
+// Per-function state for solving the given checks of F
+void SMTQuery::startChecks(Function &F, BackEdges backEdges,
+                           ArrayRef<std::pair<CallInst *, KINT_TYPE>> checks) {
+  deadline = budgetEnd;
+  if (FunctionDeadline)
+    deadline = std::min(deadline, std::chrono::steady_clock::now() +
+                                  std::chrono::seconds(FunctionDeadline));
+
+  concreteSat.clear();
+  if (cache) {
+    cache->startFunction(F);
+    cexEval.reset(new ConcreteEvaluator(F, F.getParent()->getDataLayout(), backEdges));
+    cexEval->setSummaries(&summaries, CallSummaries);
+    cexEval->setSummaryIndex(&index);
+    cexStale = true;
+  }
+  if (ConcreteBatches)
+    evalConcrete(F, backEdges, checks);
+}
+
+// A check skipped by -kint-dedup counts as SAT, its source operation having
+// been reported.
+SolveResult SMTQuery::doCheck(CallInst *CI, BackEdges backEdges, KINT_TYPE type) {
+  SiteKey site;
+  bool hasSite = Dedup != DEDUP_OFF && getSiteKey(CI, type, site);
+  if (hasSite && reportedSites.count(site)) {
+    ++NumDedupSkipped;
+    return SOLVE_SAT;
+  }
+
+  // Only a query in progress gets to finish past the deadline; use workers
+  // to cut that one short as well.
+  if (!concreteSat.count(CI) && std::chrono::steady_clock::now() >= deadline) {
+    ++NumPastDeadline;
+    ++NumUnknown;
+    addReport(CI, backEdges, type, "unknown", 0);
+    return SOLVE_UNKNOWN;
+  }
+
   auto &DL = CI->getModule()->getDataLayout();
-  SMTSolver solver;
-  ValueConstraint ValCon(solver, DL);
+  auto start = std::chrono::steady_clock::now();
+  QueryCache::QueryKeys keys;
+  bool cexHit = false;
+  bool sat;
+
+  if (cache && !concreteSat.count(CI)) {
+    ++NumCacheLookups;
+    cache->getKeys(CI, type, keys);
+    if (cache->isKnownUnsat(keys)) {
+      ++NumCoreHits;
+      return SOLVE_UNSAT;
+    }
+    cexHit = tryCounterexamples(CI, backEdges, type);
+  }
+
+  // A counterexample hit keeps its witness in concreteSat, but is counted
+  // only as a hit.
+  if (cexHit) {
+    sat = true;
+    ++NumCexHits;
+  } else if (concreteSat.count(CI)) {
+    sat = true;
+    ++NumConcreteSat;
+  } else if (NarrowWidth) {
+    sat = solveTiered(CI, backEdges, type, cache ? &keys : nullptr);
+  } else if (cache) {
+    // Queries are split into assumptions to learn cores from, and models
+    // are kept for later queries.
+    SMTConfig config;
+    config.incremental = true;
+    config.modelGen = true;
+    setSolverOptions(config);
+    SMTSolver solver(config);
+    ValueConstraint ValCon(solver, DL);
+    ValCon.setAbstractNonlinear(AbstractNonlinear);
+    setUp(ValCon);
+
+    SmallVector<SMTExpr, 8> parts;
+    auto expr = buildQuery(ValCon, CI, backEdges, type, &keys, &parts);
+    sat = solveRefined(solver, ValCon, expr, parts);
+    if (sat)
+      addAssignment(solver, ValCon, CI->getFunction());
+    else
+      addCore(solver, keys, parts);
+  } else if (portfolio.empty()) {
+    SMTConfig config;
+    config.incremental = AbstractNonlinear != 0;
+    config.modelGen = AbstractNonlinear != 0 || ModelGen;
+    setSolverOptions(config);
+    SMTSolver solver(config);
+    ValueConstraint ValCon(solver, DL);
+    ValCon.setAbstractNonlinear(AbstractNonlinear);
+    setUp(ValCon);
+
+    auto expr = buildQuery(ValCon, CI, backEdges, type);
+    std::string key;
+    if (!lookupVerdict(expr, key, sat)) {
+      sat = solve(solver, ValCon, expr);
+      storeVerdict(key, sat);
+    }
+  } else {
+    // Terms do not depend on the configuration, so the query is built once
+    // and every solver lowers it on its own.
+    auto arena = std::make_shared<SMTTermArena>();
+    std::vector<std::unique_ptr<SMTSolver>> owners;
+    SmallVector<SMTSolver *, 4> solvers;
+
+    for (auto &config: portfolio) {
+      owners.emplace_back(new SMTSolver(config, arena));
+      solvers.push_back(owners.back().get());
+    }
+
+    ValueConstraint ValCon(*owners.front(), DL);
+    setUp(ValCon);
+    SmallVector<SMTExpr, 4> exprs(solvers.size(), buildQuery(ValCon, CI, backEdges, type));
+    std::string key;
+    if (!lookupVerdict(exprs.front(), key, sat)) {
+      sat = SMTSolver::smt_query_portfolio(solvers, exprs);
+      storeVerdict(key, sat);
+    }
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (!SlowQueryDir.empty() && elapsed.count() * 1000 >= SlowQueryMs)
+    captureQuery(CI, backEdges, type, sat ? "sat" : "unsat", elapsed.count());
+  if (costLog && !concreteSat.count(CI))
+    logCost(CI, type, sat ? "sat" : "unsat", elapsed.count());
+
+  if (sat) {
+    addReport(CI, backEdges, type, "sat", elapsed.count());
+    if (hasSite)
+      reportedSites.insert(site);
+  }
+  return sat ? SOLVE_SAT : SOLVE_UNSAT;
+}
+
+// See -kint-persist. Queries with abstracted operators are not kept, their
+// terms do not determine the verdict; key is left empty for those.
+bool SMTQuery::lookupVerdict(SMTExpr expr, std::string &key, bool &sat) {
+  return Persist && !AbstractNonlinear &&
+         PersistentState::get().lookupVerdict(expr, key, sat);
+}
+
+void SMTQuery::storeVerdict(StringRef key, bool sat) {
+  if (!key.empty())
+    PersistentState::get().storeVerdict(key, sat, PersistVerdicts);
+}
+
+void SMTQuery::addReport(CallInst *CI, BackEdges backEdges, KINT_TYPE type,
+                         StringRef verdict, double seconds) {
+  if (reports.contains(CI))
+    return;
+  reports.insert(CI);
+  printReport(CI, backEdges, type, verdict, seconds);
+}
+
+// Whatever mode solved it, the query is written in its plain form: the
+// exact encoding of the check and its path, as one assertion.
+void SMTQuery::captureQuery(CallInst *CI, BackEdges backEdges, KINT_TYPE type,
+                            StringRef verdict, double seconds) {
+  Report R;
+  describeCheck(CI, type, R);
+
+  std::string name = R.function;
+  for (auto &c: name) {
+    if (!isAlnum(c) && c != '_' && c != '.')
+      c = '_';
+  }
+  SmallString<128> model(SlowQueryDir);
+  sys::path::append(model, name + "-%%%%%%.smt2");
+  int fd;
+  SmallString<128> path;
+  if (sys::fs::createUniqueFile(model, fd, path)) {
+    errs() << "kint: cannot create a file in '" << SlowQueryDir << "'\n";
+    return;
+  }
+  raw_fd_ostream OS(fd, true);
+
+  OS << "; module: " << R.module << "\n"
+     << "; function: " << R.function << "\n"
+     << "; block: " << R.block << "\n"
+     << "; inst: " << StringRef(R.inst).trim() << "\n";
+  if (!R.file.empty())
+    OS << "; location: " << R.file << ":" << R.line << ":" << R.column << "\n";
+  OS << "; check: " << ReportSink::getKindName(type) << "\n"
+     << "; verdict: " << verdict << "\n"
+     << "; seconds: " << format("%.3f", seconds) << "\n";
+
+  SMTSolver builder;
+  ValueConstraint ValCon(builder, CI->getModule()->getDataLayout());
+  setUp(ValCon);
+  SMTExpr expr = buildQuery(ValCon, CI, backEdges, type);
+  printSMTLIB2(OS, expr);
+  ++NumSlowQueries;
+}
+
+// Build the queries of the function up front and solve them in the worker
+// pool, then report as doCheck() would have, in check order. A query whose
+// worker crashed or was killed is reported as unknown, which does not
+// count as reporting its source location.
+void SMTQuery::doChecksInWorkers(ArrayRef<std::pair<CallInst *, KINT_TYPE>> checks,
+                                 BackEdges backEdges) {
+  // Never lowered, it only builds the terms.
+  SMTSolver builder;
+  SmallVector<SMTExpr, 32> queries;
+  SmallVector<int, 32> queryOf(checks.size(), -1);
+
+  for (size_t i = 0; i < checks.size(); ++i) {
+    auto *CI = checks[i].first;
+    SiteKey site;
+    if (concreteSat.count(CI) ||
+        (Dedup != DEDUP_OFF && getSiteKey(CI, checks[i].second, site) &&
+         reportedSites.count(site)))
+      continue;
+
+    ValueConstraint ValCon(builder, CI->getModule()->getDataLayout());
+    setUp(ValCon);
+    queryOf[i] = queries.size();
+    queries.push_back(buildQuery(ValCon, CI, backEdges, checks[i].second));
+  }
+
+  // Queries answered by a kept verdict never reach a worker.
+  SmallVector<SolveResult, 32> results(queries.size());
+  SmallVector<double, 32> seconds(queries.size());
+  SmallVector<std::string, 32> keys(queries.size());
+  SmallVector<SMTExpr, 32> misses;
+  SmallVector<size_t, 32> missOf;
+  for (size_t q = 0; q < queries.size(); ++q) {
+    bool sat;
+    if (lookupVerdict(queries[q], keys[q], sat)) {
+      results[q] = sat ? SOLVE_SAT : SOLVE_UNSAT;
+      continue;
+    }
+    misses.push_back(queries[q]);
+    missOf.push_back(q);
+  }
+
+  SmallVector<SolveResult, 32> missResults(misses.size());
+  SmallVector<double, 32> missSeconds(misses.size());
+  pool->solve(misses, missResults, missSeconds, deadline);
+  for (size_t m = 0; m < misses.size(); ++m) {
+    auto q = missOf[m];
+    results[q] = missResults[m];
+    seconds[q] = missSeconds[m];
+    if (missResults[m] != SOLVE_UNKNOWN)
+      storeVerdict(keys[q], missResults[m] == SOLVE_SAT);
+  }
+
+  // Queries never handed to a worker took no time.
+  static const char *const verdicts[] = { "unsat", "sat", "unknown" };
+  for (size_t i = 0; i < checks.size(); ++i) {
+    if (queryOf[i] < 0)
+      continue;
+    auto result = results[queryOf[i]];
+    auto secs = seconds[queryOf[i]];
+    if (!SlowQueryDir.empty() && secs * 1000 >= SlowQueryMs)
+      captureQuery(checks[i].first, backEdges, checks[i].second, verdicts[result], secs);
+    if (costLog && (result != SOLVE_UNKNOWN || secs > 0))
+      logCost(checks[i].first, checks[i].second, verdicts[result], secs);
+  }
+
+  for (size_t i = 0; i < checks.size(); ++i) {
+    auto *CI = checks[i].first;
+    auto type = checks[i].second;
+    SiteKey site;
+    bool hasSite = Dedup != DEDUP_OFF && getSiteKey(CI, type, site);
+    if (hasSite && reportedSites.count(site)) {
+      ++NumDedupSkipped;
+      continue;
+    }
+
+    if (concreteSat.count(CI)) {
+      ++NumConcreteSat;
+      addReport(CI, backEdges, type, "sat", 0);
+    } else if (results[queryOf[i]] == SOLVE_SAT) {
+      addReport(CI, backEdges, type, "sat", seconds[queryOf[i]]);
+    } else {
+      if (results[queryOf[i]] == SOLVE_UNKNOWN) {
+        ++NumUnknown;
+        addReport(CI, backEdges, type, "unknown", seconds[queryOf[i]]);
+      }
+      continue;
+    }
+    if (hasSite)
+      reportedSites.insert(site);
+  }
+}
+
+// Estimate the cost of every query from its terms, built but never lowered.
+void SMTQuery::estimateCosts(ArrayRef<std::pair<CallInst *, KINT_TYPE>> checks,
+                             BackEdges backEdges) {
+  SMTSolver builder;
+  for (auto &C: checks) {
+    ValueConstraint ValCon(builder, C.first->getModule()->getDataLayout());
+    setUp(ValCon);
+    costs[C.first] = estimateCost(buildQuery(ValCon, C.first, backEdges, C.second));
+  }
+}
+
+// One line per solved query, for calibrating estimateCost() against the
+// solver
+void SMTQuery::logCost(CallInst *CI, KINT_TYPE type, StringRef verdict, double seconds) {
+  Report R;
+  describeCheck(CI, type, R);
+  auto &C = costs[CI];
+
+  auto &OS = *costLog;
+  OS << R.function << "\t" << R.block << "\t";
+  if (R.file.empty())
+    OS << "-";
+  else
+    OS << R.file << ":" << R.line << ":" << R.column;
+  OS << "\t" << ReportSink::getKindName(type) << "\t" << C.nodes << "\t" << C.maxWidth
+     << "\t" << C.nonlinear << "\t" << C.gates << "\t" << format("%.6f", seconds)
+     << "\t" << verdict << "\n";
+}
+
+// Evaluate CI under every cached counterexample at once. A hit is recorded
+// like a concrete SAT answer, with the counterexample as its witness.
+bool SMTQuery::tryCounterexamples(CallInst *CI, BackEdges backEdges, KINT_TYPE type) {
+  if (cexStale) {
+    SmallVector<QueryCache::Assignment, 16> assignments;
+    cache->getAssignments(assignments);
+    cexEval->startBatch(0);
+    cexLanes = assignments.size();
+    if (cexLanes > ConcreteEvaluator::Lanes)
+      cexLanes = ConcreteEvaluator::Lanes;
+    for (unsigned lane = 0; lane < cexLanes; ++lane) {
+      for (auto &V: assignments[lane])
+        cexEval->pin(lane, V.first, V.second);
+    }
+    cexStale = false;
+  }
+  if (!cexLanes)
+    return false;
+
+  auto lanes = cexEval->evalCheck(CI, type);
+  if (cexLanes < ConcreteEvaluator::Lanes)
+    lanes &= (1ULL << cexLanes) - 1;
+  if (!lanes)
+    return false;
+
+  cexEval->getArgWitness(countTrailingZeros(lanes), concreteSat[CI]);
+  return true;
+}
+
+// Keep the model of a SAT query, which must have been solved with model
+// generation.
+void SMTQuery::addAssignment(SMTSolver &solver, ValueConstraint &ValCon, Function *F) {
+  QueryCache::Assignment values;
+  for (auto *V: ValCon.leaves) {
+    auto expr = ValCon.valueToExpr.lookup(V);
+    if (!expr || solver.smt_get_width(expr) > 64)
+      continue;
+    values.emplace_back(V, solver.smt_assignment(expr).getZExtValue());
+  }
+  cache->addAssignment(F, std::move(values));
+  cexStale = true;
+}
+
+// Keep the parts an UNSAT query, built with buildQuery(..., &keys, &parts),
+// was found UNSAT under.
+void SMTQuery::addCore(SMTSolver &solver, const QueryCache::QueryKeys &keys,
+                       ArrayRef<SMTExpr> parts) {
+  SmallVector<unsigned, 8> core;
+  for (unsigned i = 0; i < parts.size(); ++i) {
+    if (solver.smt_failed(parts[i]))
+      core.push_back(keys.keys[i]);
+  }
+  if (cache->addCore(core))
+    ++NumCoresLearned;
+}
+
+bool SMTQuery::getSiteKey(CallInst *CI, KINT_TYPE type, SiteKey &key) {
+  auto *I = checkedInsts.get(CI);
+  auto *Loc = I->getDebugLoc().get();
+  if (!Loc || !Loc->getLine())
+    return false;
+
+  key = SiteKey(Loc->getScope(), Loc->getLine(), Loc->getColumn(),
+                Dedup == DEDUP_INLINED ? Loc->getInlinedAt() : nullptr,
+                I->getOpcode(), type);
+  return true;
+}
+
+// Checks whose path constraint spans fewer blocks come first, so the copy
+// of a source operation that is cheapest to solve is the one reported.
+void SMTQuery::sortByCost(MutableArrayRef<std::pair<CallInst *, KINT_TYPE>> checks) {
+  DenseMap<const BasicBlock *, unsigned> cost;
+
+  auto getCost = [&](const BasicBlock *BB) {
+    auto it = cost.find(BB);
+    if (it != cost.end())
+      return it->second;
+
+    SmallPtrSet<const BasicBlock *, 32> seen;
+    SmallVector<const BasicBlock *, 32> worklist = { BB };
+    while (!worklist.empty()) {
+      auto *Cur = worklist.pop_back_val();
+      if (seen.insert(Cur).second)
+        worklist.append(pred_begin(Cur), pred_end(Cur));
+    }
+    return cost[BB] = seen.size();
+  };
+
+  std::stable_sort(checks.begin(), checks.end(), [&](const std::pair<CallInst *, KINT_TYPE> &a,
+                                                     const std::pair<CallInst *, KINT_TYPE> &b) {
+    return getCost(a.first->getParent()) < getCost(b.first->getParent());
+  });
+}
+
+// With keys and parts, the guards, check and path constraint are returned in
+// parts, in the order of keys->keys, to be assumed, and the result holds only
+// what must be asserted.
+SMTExpr SMTQuery::buildQuery(ValueConstraint &ValCon, CallInst *CI, BackEdges backEdges,
+                             KINT_TYPE type, const QueryCache::QueryKeys *keys,
+                             SmallVectorImpl<SMTExpr> *parts) {
+  auto &solver = ValCon.getSolver();
   PathConstraint PathCon(ValCon, backEdges);
 
   SMTExpr valExpr;
@@ -113,14 +1227,209 @@ void SMTQuery::doCheck(CallInst *CI,
   }
 
   auto pcExpr = PathCon.calcConstraint(CI->getParent());
+
+  if (keys) {
+    for (auto &G: keys->guards)
+      parts->push_back(PathCon.calcBranchConstraint(G.first, G.second));
+    parts->push_back(valExpr);
+    parts->push_back(pcExpr);
+    return ValCon.takeLemmas();
+  }
+
   auto expr = solver.smt_and(pcExpr, valExpr);
-  solver.smt_release(pcExpr);
-  solver.smt_release(valExpr);
 
-  if (solver.smt_query(expr)) {
-    if (!reports.contains(CI)) {
-      reports.insert(CI);
-      printReport(CI);
+  auto lemmas = ValCon.takeLemmas();
+  return solver.smt_and(expr, lemmas);
+}
+
+bool SMTQuery::solve(SMTSolver &solver, ValueConstraint &ValCon, SMTExpr expr) {
+  return AbstractNonlinear ? solveRefined(solver, ValCon, expr) : solver.smt_query(expr);
+}
+
+// Solve a query built with abstracted nonlinear terms: UNSAT is final, SAT
+// only once the model agrees with the exact operators. Assumptions are
+// renewed for every round, an empty expr means it is already asserted.
+bool SMTQuery::solveRefined(SMTSolver &solver, ValueConstraint &ValCon, SMTExpr expr,
+                            ArrayRef<SMTExpr> assumptions) {
+  if (expr)
+    solver.smt_assert(expr);
+
+  while (true) {
+    for (auto A: assumptions)
+      solver.smt_assume(A);
+    if (!solver.smt_check())
+      return false;
+    if (!ValCon.refineAbstractions())
+      return true;
+    ++NumRefinementRounds;
+  }
+}
+
+// Solve with narrowed free variables first. A SAT answer is accepted once
+// the full-width query is confirmed under the same inputs, which is cheap
+// since fixing every input lets the rewriter fold almost everything away.
+// Only if the narrow query is UNSAT do we pay for a real full-width solve.
+bool SMTQuery::solveTiered(CallInst *CI, BackEdges backEdges, KINT_TYPE type,
+                           const QueryCache::QueryKeys *keys) {
+  auto &DL = CI->getModule()->getDataLayout();
+  SMTConfig config;
+  config.incremental = AbstractNonlinear != 0;
+  config.modelGen = true;
+  setSolverOptions(config);
+  SMTSolver narrow(config);
+  ValueConstraint NarrowCon(narrow, DL);
+  NarrowCon.setAbstractNonlinear(AbstractNonlinear);
+  setUp(NarrowCon);
+  NarrowCon.setNarrowWidth(NarrowWidth);
+
+  config.incremental = true;
+  config.modelGen = AbstractNonlinear != 0 || ModelGen || keys;
+  SMTSolver full(config);
+  ValueConstraint FullCon(full, DL);
+  FullCon.setAbstractNonlinear(AbstractNonlinear);
+  setUp(FullCon);
+  SmallVector<SMTExpr, 8> parts;
+  full.smt_assert(buildQuery(FullCon, CI, backEdges, type, keys, &parts));
+
+  if (solve(narrow, NarrowCon, buildQuery(NarrowCon, CI, backEdges, type))) {
+    SmallVector<SMTExpr, 16> inputs(parts.begin(), parts.end());
+    for (auto *V: NarrowCon.leaves) {
+      auto var = FullCon.valueToExpr.lookup(V);
+      if (!var)
+        continue;
+      auto val = full.smt_const(narrow.smt_assignment(NarrowCon.valueToExpr.lookup(V)));
+      inputs.push_back(full.smt_eq(var, val));
+    }
+
+    bool confirmed = solveRefined(full, FullCon, nullptr, inputs);
+    if (confirmed) {
+      ++NumNarrowSat;
+      if (keys)
+        addAssignment(narrow, NarrowCon, CI->getFunction());
+      return true;
     }
   }
+
+  ++NumNarrowFallback;
+  bool sat = solveRefined(full, FullCon, nullptr, parts);
+  if (keys && sat)
+    addAssignment(full, FullCon, CI->getFunction());
+  else if (keys)
+    addCore(full, *keys, parts);
+  return sat;
+}
+
+// Returns true if the condition built by Cond can never hold when control
+// reaches CI. The path constraint is built in its over-approximating form, so
+// an UNSAT answer is a proof and safe to hand to the optimizer.
+bool SMTQuery::isImpossible(CallInst *CI, BackEdges backEdges,
+  function_ref<SMTExpr(SMTSolver &, ValueConstraint &)> Cond) {
+  auto &DL = CI->getModule()->getDataLayout();
+  SMTConfig config;
+  config.modelGen = ModelGen;
+  setSolverOptions(config);
+  SMTSolver solver(config);
+  ValueConstraint ValCon(solver, DL);
+  setUp(ValCon);
+  // Callers outside the program may pass anything to an exported function,
+  // so what the index saw at its call sites proves nothing here.
+  ValCon.setSummaryIndex(&index, /* argRanges */ false);
+  PathConstraint PathCon(ValCon, backEdges, true);
+
+  auto condExpr = Cond(solver, ValCon);
+  auto pcExpr = PathCon.calcConstraint(CI->getParent());
+  auto expr = solver.smt_and(pcExpr, condExpr);
+
+  return !solver.smt_query(expr);
+}
+
+bool SMTQuery::strengthen(CallInst *CI, BackEdges backEdges) {
+  auto *BO = dyn_cast<BinaryOperator>(checkedInsts.get(CI));
+  if (!BO)
+    return false;
+
+  auto *V1 = BO->getOperand(0);
+  auto *V2 = BO->getOperand(1);
+  auto opcode = BO->getOpcode();
+  bool Changed = false;
+
+  switch (opcode) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+    if (!BO->hasNoUnsignedWrap() &&
+        isImpossible(CI, backEdges, [&](SMTSolver &, ValueConstraint &VC) {
+          return VC.calcOverflowConstraint(opcode, V1, V2, false);
+        })) {
+      BO->setHasNoUnsignedWrap();
+      Changed = true;
+      ++NumNUW;
+    }
+    if (!BO->hasNoSignedWrap() &&
+        isImpossible(CI, backEdges, [&](SMTSolver &, ValueConstraint &VC) {
+          return VC.calcOverflowConstraint(opcode, V1, V2, true);
+        })) {
+      BO->setHasNoSignedWrap();
+      Changed = true;
+      ++NumNSW;
+    }
+    break;
+
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::UDiv:
+  case Instruction::SDiv:
+    // The proofs below are written for scalars.
+    if (BO->getType()->isVectorTy())
+      break;
+
+    // exact: no set bits are shifted out, or the remainder is zero.
+    if (!BO->isExact() &&
+        isImpossible(CI, backEdges, [&](SMTSolver &solver, ValueConstraint &VC) {
+          auto e1 = VC.calcConstraint(V1);
+          auto e2 = VC.calcConstraint(V2);
+          SMTExpr lost;
+          if (opcode == Instruction::LShr || opcode == Instruction::AShr) {
+            auto shr = opcode == Instruction::LShr ? solver.smt_lshr(e1, e2) :
+                                                     solver.smt_ashr(e1, e2);
+            auto shl = solver.smt_shl(shr, e2);
+            lost = solver.smt_ne(shl, e1);
+          } else {
+            auto rem = opcode == Instruction::UDiv ? solver.smt_urem(e1, e2) :
+                                                     solver.smt_srem(e1, e2);
+            auto zero = solver.smt_const(APInt::getNullValue(solver.smt_get_width(rem)));
+            lost = solver.smt_ne(rem, zero);
+          }
+          return lost;
+        })) {
+      BO->setIsExact();
+      Changed = true;
+      ++NumExact;
+    }
+
+    if (opcode != Instruction::UDiv && opcode != Instruction::SDiv)
+      break;
+
+    // Division by zero is already UB, but the fact that this particular
+    // divisor is non-zero here is lost to everything else that uses it.
+    if (!isa<Constant>(V2) &&
+        isImpossible(CI, backEdges, [&](SMTSolver &solver, ValueConstraint &VC) {
+          auto e2 = VC.calcConstraint(V2);
+          auto zero = solver.smt_const(APInt::getNullValue(solver.smt_get_width(e2)));
+          return solver.smt_eq(e2, zero);
+        })) {
+      auto *nonZero = CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_NE, V2,
+                                      Constant::getNullValue(V2->getType()), "", BO);
+      auto *assume = Intrinsic::getDeclaration(BO->getModule(), Intrinsic::assume);
+      CallInst::Create(assume, { nonZero }, "", BO);
+      Changed = true;
+      ++NumAssume;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return Changed;
 }
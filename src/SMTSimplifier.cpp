@@ -0,0 +1,419 @@
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <algorithm>
+#include "SMTSimplifier.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumNodesAsserted,   "Number of term nodes asserted, before simplification");
+STATISTIC(NumNodesSimplified, "Number of term nodes asserted, after simplification");
+STATISTIC(NumVarsEliminated,  "Number of variables eliminated by asserted equalities");
+STATISTIC(NumKnownOutcomes,   "Number of terms fixed by a top-level conjunct");
+
+// Each round may enable eliminations in the next one
+static const unsigned MaxEliminationRounds = 8;
+
+static bool isCommutative(SMTOp op) {
+  switch (op) {
+  case SMT_AND:
+  case SMT_OR:
+  case SMT_XOR:
+  case SMT_ADD:
+  case SMT_MUL:
+  case SMT_EQ:
+  case SMT_NE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isConst(const SMTTerm *T, uint64_t value) {
+  return T->isConst() && T->value == value;
+}
+
+static bool isAllOnes(const SMTTerm *T) {
+  return T->isConst() && T->value.isAllOnes();
+}
+
+// The constant c of x + c, with x in base
+static bool matchOffset(const SMTTerm *T, const SMTTerm *&base, APInt &offset) {
+  if (T->op != SMT_ADD || !T->ops[1]->isConst())
+    return false;
+  base = T->ops[0];
+  offset = T->ops[1]->value;
+  return true;
+}
+
+const SMTTerm *SMTSimplifier::fold(const SMTTerm *T, ArrayRef<const SMTTerm *> ops) {
+  return fold(T->op, ops, T->param0, T->param1);
+}
+
+const SMTTerm *SMTSimplifier::fold(SMTOp op, ArrayRef<const SMTTerm *> opsIn,
+                                   unsigned param0, unsigned param1) {
+  SmallVector<const SMTTerm *, 3> ops(opsIn.begin(), opsIn.end());
+
+  if (std::all_of(ops.begin(), ops.end(), [](const SMTTerm *T) { return T->isConst(); })) {
+    SmallVector<APInt, 3> args;
+    for (auto *T: ops)
+      args.push_back(T->value);
+    auto width = SMTTermArena::getResultWidth(op, ops, param0, param1);
+    return arena.getConst(evaluateOp(op, width, param1, args));
+  }
+
+  // Constants go to the right, so the rules below only look there.
+  if (isCommutative(op) && ops[0]->isConst())
+    std::swap(ops[0], ops[1]);
+
+  auto *a = ops[0];
+  auto *b = ops.size() > 1 ? ops[1] : nullptr;
+  auto w = a->width;
+  const SMTTerm *base;
+  APInt offset;
+
+  switch (op) {
+  case SMT_NOT:
+    if (a->op == SMT_NOT)
+      return a->ops[0];
+    break;
+  case SMT_NEG:
+    if (a->op == SMT_NEG)
+      return a->ops[0];
+    break;
+
+  case SMT_AND:
+    if (isConst(b, 0))
+      return b;
+    if (isAllOnes(b) || a == b)
+      return a;
+    break;
+  case SMT_OR:
+    if (isAllOnes(b))
+      return b;
+    if (isConst(b, 0) || a == b)
+      return a;
+    break;
+  case SMT_XOR:
+    if (isConst(b, 0))
+      return a;
+    if (a == b)
+      return getConst(w, 0);
+    break;
+  case SMT_IMPLIES:
+    if (isConst(a, 0) || isConst(b, 1) || a == b)
+      return getConst(1, 1);
+    if (isConst(a, 1))
+      return b;
+    if (isConst(b, 0))
+      return fold(SMT_NOT, { a });
+    break;
+
+  case SMT_ADD:
+    if (isConst(b, 0))
+      return a;
+    // (x + c1) + c2 = x + (c1 + c2)
+    if (b->isConst() && matchOffset(a, base, offset))
+      return fold(SMT_ADD, { base, arena.getConst(offset + b->value) });
+    break;
+  case SMT_SUB:
+    if (isConst(b, 0))
+      return a;
+    if (a == b)
+      return getConst(w, 0);
+    // x - c = x + -c, so that offsets fold
+    if (b->isConst())
+      return fold(SMT_ADD, { a, arena.getConst(-b->value) });
+    break;
+  case SMT_MUL:
+    if (isConst(b, 0) || isConst(b, 1))
+      return isConst(b, 0) ? b : a;
+    if (b->isConst() && b->value.isPowerOf2())
+      return fold(SMT_SHL, { a, getConst(w, b->value.logBase2()) });
+    break;
+
+  case SMT_UDIV:
+  case SMT_SDIV:
+    if (isConst(b, 1))
+      return a;
+    break;
+  case SMT_UREM:
+  case SMT_SREM:
+    if (isConst(b, 1))
+      return getConst(w, 0);
+    break;
+  case SMT_SHL:
+  case SMT_LSHR:
+  case SMT_ASHR:
+    if (isConst(b, 0))
+      return a;
+    break;
+
+  case SMT_SADDO:
+  case SMT_UADDO:
+  case SMT_SSUBO:
+  case SMT_USUBO:
+    if (isConst(b, 0))
+      return getConst(1, 0);
+    break;
+  case SMT_SMULO:
+  case SMT_UMULO:
+    if (isConst(b, 0) || isConst(a, 0))
+      return getConst(1, 0);
+    // A signed i1 of 1 is -1, and -1 * -1 overflows
+    if ((op == SMT_UMULO || w > 1) && (isConst(b, 1) || isConst(a, 1)))
+      return getConst(1, 0);
+    break;
+
+  case SMT_EQ:
+  case SMT_NE: {
+    bool eq = op == SMT_EQ;
+    if (a == b)
+      return getConst(1, eq);
+    // Booleans compared with a constant
+    if (w == 1 && b->isConst())
+      return b->value.getBoolValue() == eq ? a : fold(SMT_NOT, { a });
+    // x + c1 == c2 iff x == c2 - c1
+    if (b->isConst() && matchOffset(a, base, offset))
+      return fold(op, { base, arena.getConst(b->value - offset) });
+    break;
+  }
+  case SMT_ULT:
+  case SMT_SLT:
+  case SMT_UGT:
+  case SMT_SGT:
+    if (a == b)
+      return getConst(1, 0);
+    if (op == SMT_ULT && isConst(b, 0))
+      return getConst(1, 0);
+    if (op == SMT_UGT && isConst(a, 0))
+      return getConst(1, 0);
+    break;
+  case SMT_ULE:
+  case SMT_SLE:
+  case SMT_UGE:
+  case SMT_SGE:
+    if (a == b)
+      return getConst(1, 1);
+    if (op == SMT_ULE && isConst(a, 0))
+      return getConst(1, 1);
+    if (op == SMT_UGE && isConst(b, 0))
+      return getConst(1, 1);
+    break;
+
+  case SMT_ZEXT:
+  case SMT_SEXT:
+    if (!param0)
+      return a;
+    break;
+  case SMT_SLICE:
+    if (param1 == 0 && param0 + 1 == w)
+      return a;
+    // Within one side of a concatenation, such as a lane of a vector
+    if (a->op == SMT_CONCAT) {
+      auto low = a->ops[1]->width;
+      if (param0 < low)
+        return fold(SMT_SLICE, { a->ops[1] }, param0, param1);
+      if (param1 >= low)
+        return fold(SMT_SLICE, { a->ops[0] }, param0 - low, param1 - low);
+    }
+    break;
+  case SMT_COND: {
+    auto *t = ops[1], *e = ops[2];
+    if (a->isConst())
+      return a->value.getBoolValue() ? t : e;
+    if (t == e)
+      return t;
+    if (t->width == 1 && isConst(t, 1) && isConst(e, 0))
+      return a;
+    if (t->width == 1 && isConst(t, 0) && isConst(e, 1))
+      return fold(SMT_NOT, { a });
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  return arena.get(op, ops, param0, param1);
+}
+
+// Rebuild Root bottom-up, folding every term. replace() may substitute a
+// term outright, before its operands are visited.
+const SMTTerm *SMTSimplifier::transform(const SMTTerm *Root,
+    DenseMap<const SMTTerm *, const SMTTerm *> &memo,
+    function_ref<const SMTTerm *(const SMTTerm *)> replace) {
+  SmallVector<std::pair<const SMTTerm *, bool>, 32> stack = { { Root, false } };
+
+  while (!stack.empty()) {
+    auto *T = stack.back().first;
+    if (memo.count(T)) {
+      stack.pop_back();
+      continue;
+    }
+
+    if (!stack.back().second) {
+      if (auto *R = replace(T)) {
+        memo[T] = R;
+        stack.pop_back();
+        continue;
+      }
+      if (!T->numOps) {
+        memo[T] = T;
+        stack.pop_back();
+        continue;
+      }
+      stack.back().second = true;
+      for (auto *Op: T->operands())
+        stack.emplace_back(Op, false);
+      continue;
+    }
+
+    SmallVector<const SMTTerm *, 3> ops;
+    for (auto *Op: T->operands())
+      ops.push_back(memo.lookup(Op));
+    memo[T] = fold(T, ops);
+    stack.pop_back();
+  }
+  return memo.lookup(Root);
+}
+
+const SMTTerm *SMTSimplifier::simplify(const SMTTerm *T) {
+  return transform(T, simplified, [&](const SMTTerm *V) -> const SMTTerm * {
+    if (V->op != SMT_VAR)
+      return nullptr;
+    auto *S = substitutions.lookup(V);
+    return S ? simplify(S) : nullptr;
+  });
+}
+
+static bool occurs(const SMTTerm *var, const SMTTerm *T) {
+  SmallPtrSet<const SMTTerm *, 32> visited;
+  SmallVector<const SMTTerm *, 32> worklist = { T };
+  while (!worklist.empty()) {
+    auto *Cur = worklist.pop_back_val();
+    if (Cur == var)
+      return true;
+    if (visited.insert(Cur).second)
+      worklist.append(Cur->operands().begin(), Cur->operands().end());
+  }
+  return false;
+}
+
+// A conjunct v, !v or v == t defines the variable v.
+bool SMTSimplifier::eliminate(const SMTTerm *C,
+                              function_ref<bool(const SMTTerm *)> canEliminate) {
+  const SMTTerm *var = nullptr, *value = nullptr;
+
+  if (C->op == SMT_VAR) {
+    var = C;
+    value = getConst(1, 1);
+  } else if (C->op == SMT_NOT && C->ops[0]->op == SMT_VAR) {
+    var = C->ops[0];
+    value = getConst(1, 0);
+  } else if (C->op == SMT_EQ && C->ops[0]->op == SMT_VAR) {
+    var = C->ops[0];
+    value = C->ops[1];
+  } else if (C->op == SMT_EQ && C->ops[1]->op == SMT_VAR) {
+    var = C->ops[1];
+    value = C->ops[0];
+  }
+
+  if (!var || substitutions.count(var) || !canEliminate(var))
+    return false;
+
+  // Earlier eliminations of this round may have made v part of t.
+  value = simplify(value);
+  if (occurs(var, value))
+    return false;
+
+  substitutions[var] = value;
+  simplified.clear();
+  ++NumVarsEliminated;
+  return true;
+}
+
+static void collectConjuncts(const SMTTerm *T, SmallVectorImpl<const SMTTerm *> &conjuncts) {
+  SmallPtrSet<const SMTTerm *, 16> visited;
+  SmallVector<const SMTTerm *, 16> worklist = { T };
+  while (!worklist.empty()) {
+    auto *Cur = worklist.pop_back_val();
+    if (!visited.insert(Cur).second)
+      continue;
+    if (Cur->op == SMT_AND && Cur->width == 1)
+      worklist.append(Cur->operands().begin(), Cur->operands().end());
+    else
+      conjuncts.push_back(Cur);
+  }
+}
+
+const SMTTerm *SMTSimplifier::simplifyAssertion(const SMTTerm *E,
+    function_ref<bool(const SMTTerm *)> canEliminate) {
+  auto *R = simplify(E);
+  SmallVector<const SMTTerm *, 16> conjuncts;
+
+  for (unsigned round = 0; round < MaxEliminationRounds; ++round) {
+    conjuncts.clear();
+    collectConjuncts(R, conjuncts);
+    bool changed = false;
+    for (auto *C: conjuncts)
+      changed |= eliminate(C, canEliminate);
+    if (!changed)
+      break;
+    R = simplify(E);
+  }
+
+  // Every conjunct holds wherever it occurs in the others. A conjunct !a is
+  // kept as is, as rewriting it under a = false would make it vanish; any
+  // other conjunct only contains strictly smaller ones, so no conjunct ends
+  // up justified by itself.
+  conjuncts.clear();
+  collectConjuncts(R, conjuncts);
+  if (conjuncts.size() > 1) {
+    DenseMap<const SMTTerm *, const SMTTerm *> known, memo;
+    for (auto *C: conjuncts) {
+      if (C->op == SMT_NOT)
+        known[C->ops[0]] = getConst(1, 0);
+      else
+        known[C] = getConst(1, 1);
+    }
+
+    auto replaceKnown = [&](const SMTTerm *T) -> const SMTTerm * {
+      auto *K = known.lookup(T);
+      if (K)
+        ++NumKnownOutcomes;
+      return K;
+    };
+
+    R = getConst(1, 1);
+    for (auto *C: conjuncts) {
+      if (C->op != SMT_NOT) {
+        SmallVector<const SMTTerm *, 3> ops;
+        for (auto *Op: C->operands())
+          ops.push_back(transform(Op, memo, replaceKnown));
+        if (!ops.empty())
+          C = fold(C, ops);
+      }
+      R = fold(SMT_AND, { R, C });
+    }
+  }
+
+  if (AreStatisticsEnabled()) {
+    NumNodesAsserted += countNodes(E);
+    NumNodesSimplified += countNodes(R);
+  }
+  return R;
+}
+
+unsigned SMTSimplifier::countNodes(const SMTTerm *T) {
+  SmallPtrSet<const SMTTerm *, 32> visited;
+  SmallVector<const SMTTerm *, 32> worklist = { T };
+  while (!worklist.empty()) {
+    auto *Cur = worklist.pop_back_val();
+    if (visited.insert(Cur).second)
+      worklist.append(Cur->operands().begin(), Cur->operands().end());
+  }
+  return visited.size();
+}
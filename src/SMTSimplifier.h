@@ -0,0 +1,56 @@
+#ifndef SMTSIMPLIFIER_H
+#define SMTSIMPLIFIER_H
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include "SMTTerm.h"
+
+// Rewrites terms into equivalent, usually smaller ones before they are
+// handed to the solver. Locally, constants are folded, constant offsets
+// merged (including those compared against a constant), multiplications by
+// a power of two turned into shifts, and tautologies dropped. Asserted
+// formulas are also simplified as a whole: a top-level equality between a
+// variable and a term eliminates the variable, which is how the PHI
+// assignments of single-predecessor paths disappear, and every other
+// top-level conjunct, such as a branch condition on the path, is known to
+// hold wherever it occurs in the rest of the formula.
+class SMTSimplifier {
+  SMTTermArena &arena;
+  // Variables eliminated by asserted equalities, and their replacements
+  llvm::DenseMap<const SMTTerm *, const SMTTerm *> substitutions;
+  // simplify() under the current substitutions
+  llvm::DenseMap<const SMTTerm *, const SMTTerm *> simplified;
+
+  const SMTTerm *transform(const SMTTerm *Root,
+                           llvm::DenseMap<const SMTTerm *, const SMTTerm *> &memo,
+                           llvm::function_ref<const SMTTerm *(const SMTTerm *)> replace);
+  const SMTTerm *fold(const SMTTerm *T, llvm::ArrayRef<const SMTTerm *> ops);
+  const SMTTerm *fold(SMTOp op, llvm::ArrayRef<const SMTTerm *> ops,
+                      unsigned param0 = 0, unsigned param1 = 0);
+  const SMTTerm *getConst(unsigned width, uint64_t value) {
+    return arena.getConst(llvm::APInt(width, value));
+  }
+  bool eliminate(const SMTTerm *conjunct,
+                 llvm::function_ref<bool(const SMTTerm *)> canEliminate);
+
+public:
+  explicit SMTSimplifier(SMTTermArena &arena) : arena(arena) {}
+
+  // Local rewriting, under the substitutions made so far
+  const SMTTerm *simplify(const SMTTerm *);
+  // Rewrite a formula that is about to be asserted. Only variables for
+  // which canEliminate() holds, i.e. not yet seen by the solver, are
+  // substituted away.
+  const SMTTerm *simplifyAssertion(const SMTTerm *,
+                                   llvm::function_ref<bool(const SMTTerm *)> canEliminate);
+  // What an eliminated variable was replaced by, or null
+  const SMTTerm *getSubstitution(const SMTTerm *var) const {
+    return substitutions.lookup(var);
+  }
+
+  static unsigned countNodes(const SMTTerm *);
+};
+
+#endif /* SMTSIMPLIFIER_H */
@@ -0,0 +1,340 @@
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Format.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SMTSolver.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumTermsLowered, "Number of terms lowered to Boolector nodes");
+STATISTIC(NumSolverResets, "Number of Boolector instances rebuilt at the node ceiling");
+STATISTIC(MaxSolverNodes,  "Most Boolector nodes held by one instance");
+
+// See smt_take_peak_nodes()
+static std::atomic<size_t> globalPeakNodes(0);
+
+namespace {
+
+struct PortfolioStats {
+  unsigned wins = 0;
+  double seconds = 0;
+};
+
+// Shared by every SMTSolver in the process, guarded by statsLock.
+std::mutex statsLock;
+StringMap<PortfolioStats> portfolioStats;
+unsigned portfolioQueries = 0;
+
+int32_t terminateIfDone(void *state) {
+  return static_cast<std::atomic<bool> *>(state)->load();
+}
+
+} // End anonymous namespace
+
+bool SMTConfig::parse(StringRef str, SMTConfig &config) {
+  StringRef engine, rewrite;
+  std::tie(engine, rewrite) = str.split(':');
+
+  auto id = StringSwitch<int>(engine)
+    .Case("fun", BTOR_ENGINE_FUN)
+    .Case("sls", BTOR_ENGINE_SLS)
+    .Case("prop", BTOR_ENGINE_PROP)
+    .Case("aigprop", BTOR_ENGINE_AIGPROP)
+    .Default(-1);
+  if (id < 0)
+    return false;
+
+  unsigned level = 3;
+  if (!rewrite.empty() &&
+      (!rewrite.consume_front("rw") || rewrite.getAsInteger(10, level) || level > 3))
+    return false;
+
+  config.name = str.str();
+  config.engine = id;
+  config.rewriteLevel = level;
+  return true;
+}
+
+bool SMTSolver::smt_query_portfolio(ArrayRef<SMTSolver *> solvers, ArrayRef<SMTExpr> exprs) {
+  assert(solvers.size() == exprs.size() && !solvers.empty());
+
+  std::atomic<bool> done(false);
+  std::mutex resultLock;
+  int32_t result = BOOLECTOR_UNKNOWN;
+  SMTSolver *winner = nullptr;
+  // Time to the first answer, not counting stopping the other threads.
+  std::chrono::duration<double> elapsed(0);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < solvers.size(); ++i) {
+    auto *S = solvers[i];
+    auto *E = exprs[i];
+    boolector_set_term(S->getBtor(), terminateIfDone, &done);
+    // Simplifying adds terms to the shared arena, so it cannot.
+    E = S->prepareAssertion(E);
+
+    // Lowering only reads the terms, so it runs in parallel too.
+    threads.emplace_back([&, S, E] {
+      boolector_assert(S->btor, S->lower(E));
+      auto r = boolector_sat(S->btor);
+      if (r != BOOLECTOR_SAT && r != BOOLECTOR_UNSAT)
+        return;
+
+      std::lock_guard<std::mutex> guard(resultLock);
+      if (!winner) {
+        winner = S;
+        result = r;
+        elapsed = std::chrono::steady_clock::now() - start;
+        done = true;
+      }
+    });
+  }
+
+  for (auto &T: threads)
+    T.join();
+
+  // Local search only gives up by design, the complete engine on an error;
+  // solve once more with a fresh instance of a complete configuration.
+  std::string name;
+  if (winner) {
+    name = winner->config.name;
+  } else {
+    auto it = find_if(solvers, [](SMTSolver *S) { return S->config.isComplete(); });
+    SMTConfig config;
+    SMTExpr E = exprs.front();
+    if (it != solvers.end()) {
+      config = (*it)->config;
+      E = exprs[it - solvers.begin()];
+    }
+    SMTSolver fallback(config, solvers.front()->arena);
+    result = fallback.smt_query(E) ? BOOLECTOR_SAT : BOOLECTOR_UNSAT;
+    elapsed = std::chrono::steady_clock::now() - start;
+    name = config.name + " (fallback)";
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(statsLock);
+    auto &stats = portfolioStats[name];
+    stats.wins += 1;
+    stats.seconds += elapsed.count();
+    portfolioQueries += 1;
+  }
+
+  return result == BOOLECTOR_SAT;
+}
+
+bool SMTSolver::smt_check() {
+  // Twice the floor, so that a solver whose assertions alone are over the
+  // ceiling is not rebuilt on every check.
+  if (config.maxNodes && nodes.size() > config.maxNodes && nodes.size() > 2 * resetFloor)
+    reset();
+
+  auto result = boolector_sat(getBtor());
+  assumptions.clear();
+  switch (result) {
+  case BOOLECTOR_SAT:
+    return true;
+  case BOOLECTOR_UNSAT:
+    return false;
+  default:
+    report_fatal_error("Boolector answered neither SAT nor UNSAT");
+  }
+}
+
+// Nodes no longer reachable from an assertion, such as those of old
+// assumptions or of terms lowered for one query only, are dropped along
+// with the instance.
+void SMTSolver::reset() {
+  peakNodes = smt_peak_nodes();
+  releaseBtor();
+  for (auto e: assertions)
+    boolector_assert(getBtor(), lower(e));
+  for (auto e: assumptions)
+    boolector_assume(getBtor(), lower(e));
+  resetFloor = nodes.size();
+  ++NumSolverResets;
+}
+
+void SMTSolver::releaseBtor() {
+  auto peak = smt_peak_nodes();
+  MaxSolverNodes.updateMax(peak);
+  auto cur = globalPeakNodes.load();
+  while (peak > cur && !globalPeakNodes.compare_exchange_weak(cur, peak))
+    ;
+
+  if (!btor)
+    return;
+  boolector_release_all(btor);
+  boolector_delete(btor);
+  btor = nullptr;
+  nodes.clear();
+}
+
+int32_t SMTSolver::smt_solve_file(const char *path, std::string &err) {
+  auto *F = fopen(path, "r");
+  if (!F) {
+    err = "cannot open file";
+    return BOOLECTOR_PARSE_ERROR;
+  }
+
+  char *msg = nullptr;
+  int32_t status;
+  bool smt2;
+  // Where the parser prints the answers of (check-sat)
+  auto *out = fopen("/dev/null", "w");
+  auto result = boolector_parse(getBtor(), F, path, out, &msg, &status, &smt2);
+  fclose(F);
+  if (out)
+    fclose(out);
+  if (result == BOOLECTOR_PARSE_ERROR)
+    err = msg ? msg : "parse error";
+  return result;
+}
+
+size_t SMTSolver::smt_take_peak_nodes() {
+  return globalPeakNodes.exchange(0);
+}
+
+// Post-order with an explicit stack; every term is lowered once per solver.
+BoolectorNode *SMTSolver::lower(SMTExpr Root) {
+  auto it = nodes.find(Root);
+  if (it != nodes.end())
+    return it->second;
+
+  SmallVector<std::pair<SMTExpr, bool>, 32> stack = { { Root, false } };
+  while (!stack.empty()) {
+    auto *T = stack.back().first;
+    if (nodes.count(T)) {
+      stack.pop_back();
+      continue;
+    }
+
+    if (!stack.back().second) {
+      stack.back().second = true;
+      for (auto *Op: T->operands())
+        stack.emplace_back(Op, false);
+      continue;
+    }
+
+    SmallVector<BoolectorNode *, 3> ops;
+    for (auto *Op: T->operands())
+      ops.push_back(nodes.lookup(Op));
+    nodes[T] = lowerOp(T, ops);
+    ++NumTermsLowered;
+    stack.pop_back();
+  }
+  return nodes.lookup(Root);
+}
+
+BoolectorNode *SMTSolver::lowerOp(SMTExpr T, ArrayRef<BoolectorNode *> ops) {
+  auto *B = getBtor();
+
+  switch (T->op) {
+  case SMT_CONST: {
+    auto bvsort = boolector_bitvec_sort(B, T->width);
+    SmallString<20> str;
+    T->value.toStringUnsigned(str, 16);
+    auto result = boolector_consth(B, bvsort, str.c_str());
+    boolector_release_sort(B, bvsort);
+    return result;
+  }
+  case SMT_VAR: {
+    auto bvsort = boolector_bitvec_sort(B, T->width);
+    auto result = boolector_var(B, bvsort, T->name.empty() ? nullptr : T->name.str().c_str());
+    boolector_release_sort(B, bvsort);
+    return result;
+  }
+  case SMT_NOT:     return boolector_not(B, ops[0]);
+  case SMT_NEG:     return boolector_neg(B, ops[0]);
+  case SMT_AND:     return boolector_and(B, ops[0], ops[1]);
+  case SMT_OR:      return boolector_or(B, ops[0], ops[1]);
+  case SMT_IMPLIES: return boolector_implies(B, ops[0], ops[1]);
+  case SMT_XOR:     return boolector_xor(B, ops[0], ops[1]);
+  case SMT_ADD:     return boolector_add(B, ops[0], ops[1]);
+  case SMT_SUB:     return boolector_sub(B, ops[0], ops[1]);
+  case SMT_MUL:     return boolector_mul(B, ops[0], ops[1]);
+  case SMT_UDIV:    return boolector_udiv(B, ops[0], ops[1]);
+  case SMT_SDIV:    return boolector_sdiv(B, ops[0], ops[1]);
+  case SMT_UREM:    return boolector_urem(B, ops[0], ops[1]);
+  case SMT_SREM:    return boolector_srem(B, ops[0], ops[1]);
+  case SMT_SHL:     return boolector_sll(B, ops[0], ops[1]);
+  case SMT_LSHR:    return boolector_srl(B, ops[0], ops[1]);
+  case SMT_ASHR:    return boolector_sra(B, ops[0], ops[1]);
+  case SMT_SADDO:   return boolector_saddo(B, ops[0], ops[1]);
+  case SMT_UADDO:   return boolector_uaddo(B, ops[0], ops[1]);
+  case SMT_SSUBO:   return boolector_ssubo(B, ops[0], ops[1]);
+  case SMT_USUBO:   return boolector_usubo(B, ops[0], ops[1]);
+  case SMT_SMULO:   return boolector_smulo(B, ops[0], ops[1]);
+  case SMT_UMULO:   return boolector_umulo(B, ops[0], ops[1]);
+  case SMT_EQ:      return boolector_eq(B, ops[0], ops[1]);
+  case SMT_NE:      return boolector_ne(B, ops[0], ops[1]);
+  case SMT_UGT:     return boolector_ugt(B, ops[0], ops[1]);
+  case SMT_UGE:     return boolector_ugte(B, ops[0], ops[1]);
+  case SMT_ULT:     return boolector_ult(B, ops[0], ops[1]);
+  case SMT_ULE:     return boolector_ulte(B, ops[0], ops[1]);
+  case SMT_SGT:     return boolector_sgt(B, ops[0], ops[1]);
+  case SMT_SGE:     return boolector_sgte(B, ops[0], ops[1]);
+  case SMT_SLT:     return boolector_slt(B, ops[0], ops[1]);
+  case SMT_SLE:     return boolector_slte(B, ops[0], ops[1]);
+  case SMT_ZEXT:    return boolector_uext(B, ops[0], T->param0);
+  case SMT_SEXT:    return boolector_sext(B, ops[0], T->param0);
+  case SMT_SLICE:   return boolector_slice(B, ops[0], T->param0, T->param1);
+  case SMT_COND:    return boolector_cond(B, ops[0], ops[1], ops[2]);
+  case SMT_CONCAT:  return boolector_concat(B, ops[0], ops[1]);
+  }
+  llvm_unreachable("Invalid term");
+}
+
+SMTExpr SMTSolver::prepareAssertion(SMTExpr e) {
+  if (!simplifier)
+    return e;
+  // Variables the solver has already seen may occur in earlier assertions.
+  return simplifier->simplifyAssertion(e, [&](SMTExpr V) { return !nodes.count(V); });
+}
+
+APInt SMTSolver::smt_assignment(SMTExpr e) {
+  auto *B = getBtor();
+  // Eliminated variables take the value of their replacement.
+  return evaluate(prepare(e), [&](SMTExpr T, APInt &value) {
+    auto *N = nodes.lookup(T);
+    if (!N) {
+      // Not part of the query, so any value will do
+      if (T->op != SMT_VAR)
+        return false;
+      value = APInt(T->width, 0);
+      return true;
+    }
+
+    auto s = boolector_bv_assignment(B, N);
+    value = APInt(T->width, s, 2);
+    boolector_free_bv_assignment(B, s);
+    return true;
+  });
+}
+
+void SMTSolver::smt_print_portfolio_stats(raw_ostream &OS) {
+  std::lock_guard<std::mutex> guard(statsLock);
+  if (!portfolioQueries)
+    return;
+
+  OS << "Portfolio wins over " << portfolioQueries << " queries:\n";
+  for (auto &KV: portfolioStats) {
+    auto &stats = KV.getValue();
+    OS << "  " << KV.getKey() << ": " << stats.wins << " wins ("
+       << format("%.1f", 100.0 * stats.wins / portfolioQueries) << "%), "
+       << format("%.3f", stats.seconds / stats.wins) << "s average\n";
+  }
+}
@@ -2,28 +2,101 @@
 #define SMTSOLVER_H
 
 #include <llvm/ADT/APInt.h>
-#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/raw_ostream.h>
 #include <boolector.h>
+#include <algorithm>
 #include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SMTSimplifier.h"
+#include "SMTTerm.h"
 
 using llvm::errs;
 
-typedef BoolectorNode *SMTExpr;
+typedef const SMTTerm *SMTExpr;
+
+// A Boolector configuration, written as "<engine>[:rw<level>]", e.g. "fun",
+// "prop" or "sls:rw1".
+struct SMTConfig {
+  std::string name = "fun";
+  uint32_t engine = BTOR_ENGINE_FUN;
+  uint32_t rewriteLevel = 3;
+  // Allow more than one smt_check() on the same solver.
+  bool incremental = false;
+  // Keep a model after SAT, needed by smt_assignment(). Slows down every
+  // smt_check(), so only enabled by callers that read the model.
+  bool modelGen = false;
+  // Run asserted and assumed terms through an SMTSimplifier first.
+  bool simplify = false;
+  // Once more terms than this are lowered, rebuild the Boolector instance
+  // before the next smt_check(), with only the assertions and pending
+  // assumptions (0 = never).
+  size_t maxNodes = 0;
+
+  static bool parse(llvm::StringRef, SMTConfig &);
+  // Local search engines can only ever answer SAT.
+  bool isComplete() const { return engine == BTOR_ENGINE_FUN; }
+};
 
+// Expressions are built as SMTTerms and only lowered to Boolector nodes, term
+// by term, once they are asserted or assumed. Solvers sharing an arena can
+// all be handed the same terms.
 class SMTSolver {
-  Btor *btor;
+  SMTConfig config;
+  std::shared_ptr<SMTTermArena> arena;
+  Btor *btor = nullptr;
+  llvm::DenseMap<const SMTTerm *, BoolectorNode *> nodes;
+  std::unique_ptr<SMTSimplifier> simplifier;
+  // What was handed to Boolector, after simplification: every assertion,
+  // and the assumptions since the last smt_check(). A reset lowers exactly
+  // these again.
+  std::vector<SMTExpr> assertions, assumptions;
+  // Nodes lowered right after the last reset, which the next one has to
+  // clearly exceed
+  size_t resetFloor = 0;
+  size_t peakNodes = 0;
+
+  Btor *getBtor()
+  {
+    if (btor)
+      return btor;
+    btor = boolector_new();
+    boolector_set_opt(btor, BTOR_OPT_PRETTY_PRINT, 1);
+    if (config.modelGen)
+      boolector_set_opt(btor, BTOR_OPT_MODEL_GEN, 1);
+    // Both have to be set before the first node is created.
+    boolector_set_opt(btor, BTOR_OPT_ENGINE, config.engine);
+    boolector_set_opt(btor, BTOR_OPT_REWRITE_LEVEL, config.rewriteLevel);
+    if (config.incremental)
+      boolector_set_opt(btor, BTOR_OPT_INCREMENTAL, 1);
+    return btor;
+  }
+  BoolectorNode *lower(SMTExpr);
+  BoolectorNode *lowerOp(SMTExpr, llvm::ArrayRef<BoolectorNode *>);
+  void releaseBtor();
+  void reset();
+  // What is lowered in place of e: e itself unless simplifying
+  SMTExpr prepareAssertion(SMTExpr e);
+  SMTExpr prepare(SMTExpr e)
+  {
+    return simplifier ? simplifier->simplify(e) : e;
+  }
 
 public:
-  SMTSolver() : btor(boolector_new())
+  SMTSolver(const SMTConfig &config = SMTConfig(),
+            std::shared_ptr<SMTTermArena> arena = nullptr) :
+    config(config), arena(arena ? std::move(arena) : std::make_shared<SMTTermArena>())
   {
-    boolector_set_opt(btor, BTOR_OPT_PRETTY_PRINT, 1);
-    boolector_set_opt(btor, BTOR_OPT_MODEL_GEN, 1);
+    if (config.simplify)
+      simplifier.reset(new SMTSimplifier(*this->arena));
   }
   ~SMTSolver()
   {
-    boolector_release_all(btor);
-    boolector_delete(btor);
+    releaseBtor();
   }
 
   // don't allow copy/move
@@ -34,251 +107,287 @@ public:
 
   SMTExpr smt_true()
   {
-    return boolector_true(btor);
+    return arena->getConst(llvm::APInt(1, 1));
   }
 
   SMTExpr smt_false()
   {
-    return boolector_false(btor);
+    return arena->getConst(llvm::APInt(1, 0));
   }
 
   SMTExpr smt_neg(SMTExpr e1)
   {
-    return boolector_neg(btor, e1);
+    return arena->get(SMT_NEG, { e1 });
+  }
+
+  SMTExpr smt_not(SMTExpr e1)
+  {
+    return arena->get(SMT_NOT, { e1 });
   }
 
   SMTExpr smt_and(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_and(btor, e1, e2);
+    return arena->get(SMT_AND, { e1, e2 });
   }
 
   SMTExpr smt_or(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_or(btor, e1, e2);
+    return arena->get(SMT_OR, { e1, e2 });
+  }
+
+  SMTExpr smt_implies(SMTExpr e1, SMTExpr e2)
+  {
+    return arena->get(SMT_IMPLIES, { e1, e2 });
   }
 
   SMTExpr smt_xor(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_xor(btor, e1, e2);
+    return arena->get(SMT_XOR, { e1, e2 });
   }
 
   SMTExpr smt_add(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_add(btor, e1, e2);
+    return arena->get(SMT_ADD, { e1, e2 });
   }
 
   SMTExpr smt_sadd_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_saddo(btor, e1, e2);
+    return arena->get(SMT_SADDO, { e1, e2 });
   }
 
   SMTExpr smt_uadd_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_uaddo(btor, e1, e2);
+    return arena->get(SMT_UADDO, { e1, e2 });
   }
 
   SMTExpr smt_sub(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sub(btor, e1, e2);
+    return arena->get(SMT_SUB, { e1, e2 });
   }
 
   SMTExpr smt_ssub_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ssubo(btor, e1, e2);
+    return arena->get(SMT_SSUBO, { e1, e2 });
   }
 
   SMTExpr smt_usub_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_usubo(btor, e1, e2);
+    return arena->get(SMT_USUBO, { e1, e2 });
   }
 
   SMTExpr smt_mul(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_mul(btor, e1, e2);
+    return arena->get(SMT_MUL, { e1, e2 });
   }
 
   SMTExpr smt_smul_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_smulo(btor, e1, e2);
+    return arena->get(SMT_SMULO, { e1, e2 });
   }
 
   SMTExpr smt_umul_overflow(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_umulo(btor, e1, e2);
+    return arena->get(SMT_UMULO, { e1, e2 });
   }
 
   SMTExpr smt_udiv(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_udiv(btor, e1, e2);
+    return arena->get(SMT_UDIV, { e1, e2 });
   }
 
   SMTExpr smt_sdiv(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sdiv(btor, e1, e2);
+    return arena->get(SMT_SDIV, { e1, e2 });
   }
 
   SMTExpr smt_urem(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_urem(btor, e1, e2);
+    return arena->get(SMT_UREM, { e1, e2 });
   }
 
   SMTExpr smt_srem(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_srem(btor, e1, e2);
+    return arena->get(SMT_SREM, { e1, e2 });
   }
 
   SMTExpr smt_shl(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sll(btor, e1, e2);
+    return arena->get(SMT_SHL, { e1, e2 });
   }
 
   SMTExpr smt_lshr(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_srl(btor, e1, e2);
+    return arena->get(SMT_LSHR, { e1, e2 });
   }
 
   SMTExpr smt_ashr(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sra(btor, e1, e2);
+    return arena->get(SMT_ASHR, { e1, e2 });
   }
 
   SMTExpr smt_eq(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_eq(btor, e1, e2);
+    return arena->get(SMT_EQ, { e1, e2 });
   }
 
   SMTExpr smt_ne(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ne(btor, e1, e2);
+    return arena->get(SMT_NE, { e1, e2 });
   }
 
   SMTExpr smt_ugt(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ugt(btor, e1, e2);
+    return arena->get(SMT_UGT, { e1, e2 });
   }
 
   SMTExpr smt_uge(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ugte(btor, e1, e2);
+    return arena->get(SMT_UGE, { e1, e2 });
   }
 
   SMTExpr smt_ult(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ult(btor, e1, e2);
+    return arena->get(SMT_ULT, { e1, e2 });
   }
 
   SMTExpr smt_ule(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_ulte(btor, e1, e2);
+    return arena->get(SMT_ULE, { e1, e2 });
   }
 
   SMTExpr smt_sgt(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sgt(btor, e1, e2);
+    return arena->get(SMT_SGT, { e1, e2 });
   }
 
   SMTExpr smt_sge(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_sgte(btor, e1, e2);
+    return arena->get(SMT_SGE, { e1, e2 });
   }
 
   SMTExpr smt_slt(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_slt(btor, e1, e2);
+    return arena->get(SMT_SLT, { e1, e2 });
   }
 
   SMTExpr smt_sle(SMTExpr e1, SMTExpr e2)
   {
-    return boolector_slte(btor, e1, e2);
+    return arena->get(SMT_SLE, { e1, e2 });
   }
 
   unsigned smt_get_width(SMTExpr e)
   {
-    return boolector_get_width(btor, e);
+    return e->width;
   }
 
   SMTExpr smt_zext(SMTExpr e, uint32_t width)
   {
-    return boolector_uext(btor, e, width);
+    return arena->get(SMT_ZEXT, { e }, width);
   }
 
   SMTExpr smt_sext(SMTExpr e, uint32_t width)
   {
-    return boolector_sext(btor, e, width);
+    return arena->get(SMT_SEXT, { e }, width);
   }
 
   SMTExpr smt_slice(SMTExpr e, uint32_t upper, uint32_t lower)
   {
-    return boolector_slice(btor, e, upper, lower);
+    return arena->get(SMT_SLICE, { e }, upper, lower);
   }
 
-  // Assume 32 bit int
-  SMTExpr smt_const(const llvm::APInt &val)
+  // hi in the upper bits, lo in the lower ones
+  SMTExpr smt_concat(SMTExpr hi, SMTExpr lo)
   {
-    auto bvsort = boolector_bitvec_sort(btor, val.getBitWidth());
-
-    llvm::SmallString<20> str;
-    val.toStringUnsigned(str, 16);
+    return arena->get(SMT_CONCAT, { hi, lo });
+  }
 
-    auto result = boolector_consth(btor, bvsort, str.c_str());
-    boolector_release_sort(btor, bvsort);
-    return result;
+  SMTExpr smt_const(const llvm::APInt &val)
+  {
+    return arena->getConst(val);
   }
 
   SMTExpr smt_cond(SMTExpr c, SMTExpr t, SMTExpr e)
   {
-    return boolector_cond(btor, c, t, e);
+    return arena->get(SMT_COND, { c, t, e });
   }
 
   SMTExpr smt_var(uint32_t width, std::string name)
   {
-    auto bvsort = boolector_bitvec_sort(btor, width);
-    auto result = boolector_var(btor, bvsort, name.c_str());
-    boolector_release_sort(btor, bvsort);
-    return result;
+    return arena->getVar(width, name);
   }
 
-  void smt_copy(SMTExpr e)
+  // Anonymous variable, for terms with no IR value behind them
+  SMTExpr smt_var(uint32_t width)
   {
-    boolector_copy(btor, e);
+    return arena->getVar(width, "");
   }
 
-  void smt_release(SMTExpr e)
+  // Where the terms of this solver are built
+  SMTTermArena &getArena() { return *arena; }
+
+  bool smt_query(SMTExpr e)
   {
-    boolector_release(btor, e);
+    smt_assert(e);
+    return smt_check();
   }
 
-  bool smt_query(SMTExpr e)
+  void smt_assert(SMTExpr e)
   {
-    boolector_assert(btor, e);
-    auto result = boolector_sat(btor);
-    switch (result) {
-    case BOOLECTOR_SAT:
-      return true;
-    case BOOLECTOR_UNSAT:
-      return false;
-    default:
-      assert(0 && "smt_query unreachable");
-    }
+    e = prepareAssertion(e);
+    assertions.push_back(e);
+    boolector_assert(getBtor(), lower(e));
   }
 
-  void smt_dump()
+  // Assume e for the next smt_check() only (incremental solvers only)
+  void smt_assume(SMTExpr e)
   {
-    boolector_dump_smt2(btor, stderr);
+    e = prepare(e);
+    assumptions.push_back(e);
+    boolector_assume(getBtor(), lower(e));
   }
 
-  void smt_print_model(char *fmt)
+  // After smt_check() answered UNSAT, whether the assumption e is part of
+  // the reason
+  bool smt_failed(SMTExpr e)
+  {
+    return boolector_failed(getBtor(), lower(prepare(e)));
+  }
+
+  bool smt_check();
+
+  // Boolector nodes currently lowered, and the most ever held at once
+  size_t smt_num_nodes() const { return nodes.size(); }
+  size_t smt_peak_nodes() const { return std::max<size_t>(peakNodes, nodes.size()); }
+  // The most nodes any solver held at once since the last call
+  static size_t smt_take_peak_nodes();
+
+  // Solve solvers[i] /\ exprs[i] for all i in parallel, each solver being
+  // the same query built under a different configuration. The first
+  // definitive answer wins and the remaining solvers are terminated.
+  static bool smt_query_portfolio(llvm::ArrayRef<SMTSolver *> solvers,
+                                  llvm::ArrayRef<SMTExpr> exprs);
+  static void smt_print_portfolio_stats(llvm::raw_ostream &);
+
+  // Everything asserted so far, as an SMT-LIB2 script
+  void smt_dump(llvm::raw_ostream &OS = llvm::errs())
   {
-    boolector_print_model(btor, fmt, stderr);
+    printSMTLIB2(OS, assertions);
   }
 
-  llvm::APInt smt_assignment(SMTExpr e)
+  // Parse the SMT-LIB2 script at path and solve it under this solver's
+  // configuration, returning BOOLECTOR_SAT, BOOLECTOR_UNSAT or
+  // BOOLECTOR_UNKNOWN, or BOOLECTOR_PARSE_ERROR with err set. Meant for a
+  // fresh solver.
+  int32_t smt_solve_file(const char *path, std::string &err);
+
+  void smt_print_model(char *fmt)
   {
-    auto s = boolector_bv_assignment(btor, e);
-    std::string sval = s;
-    boolector_free_bv_assignment(btor, s);
-    return llvm::APInt(smt_get_width(e), sval.c_str(), 2);
+    boolector_print_model(getBtor(), fmt, stderr);
   }
+
+  // Only valid after a SAT smt_check() with SMTConfig::modelGen set. Terms
+  // never handed to the solver are evaluated over the model instead.
+  llvm::APInt smt_assignment(SMTExpr e);
 };
 
 #endif /* SMTSOLVER_H */
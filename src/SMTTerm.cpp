@@ -0,0 +1,625 @@
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "SMTTerm.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumTerms,       "Number of terms created");
+STATISTIC(NumTermsShared, "Number of terms shared with an equal one");
+
+void SMTTerm::Profile(FoldingSetNodeID &ID) const {
+  ID.AddInteger(op);
+  ID.AddInteger(width);
+  ID.AddInteger(param0);
+  ID.AddInteger(param1);
+  for (auto *T: operands())
+    ID.AddPointer(T);
+  if (op == SMT_CONST)
+    value.Profile(ID);
+}
+
+SMTTerm *SMTTermArena::create(SMTOp op, unsigned width) {
+  ++NumTerms;
+  return new (allocator.Allocate()) SMTTerm(op, width, numTerms++);
+}
+
+unsigned SMTTermArena::getResultWidth(SMTOp op, ArrayRef<const SMTTerm *> ops,
+                                      unsigned param0, unsigned param1) {
+  switch (op) {
+  case SMT_SADDO:
+  case SMT_UADDO:
+  case SMT_SSUBO:
+  case SMT_USUBO:
+  case SMT_SMULO:
+  case SMT_UMULO:
+  case SMT_EQ:
+  case SMT_NE:
+  case SMT_UGT:
+  case SMT_UGE:
+  case SMT_ULT:
+  case SMT_ULE:
+  case SMT_SGT:
+  case SMT_SGE:
+  case SMT_SLT:
+  case SMT_SLE:
+    return 1;
+  case SMT_ZEXT:
+  case SMT_SEXT:
+    return ops[0]->width + param0;
+  case SMT_SLICE:
+    return param0 - param1 + 1;
+  case SMT_COND:
+    return ops[1]->width;
+  case SMT_CONCAT:
+    return ops[0]->width + ops[1]->width;
+  default:
+    return ops[0]->width;
+  }
+}
+
+const SMTTerm *SMTTermArena::get(SMTOp op, ArrayRef<const SMTTerm *> ops,
+                                 unsigned param0, unsigned param1) {
+  assert(op != SMT_CONST && op != SMT_VAR && !ops.empty() && ops.size() <= 3);
+
+  // Same layout as SMTTerm::Profile()
+  FoldingSetNodeID ID;
+  auto width = getResultWidth(op, ops, param0, param1);
+  ID.AddInteger(op);
+  ID.AddInteger(width);
+  ID.AddInteger(param0);
+  ID.AddInteger(param1);
+  for (auto *T: ops)
+    ID.AddPointer(T);
+
+  void *pos;
+  if (auto *T = terms.FindNodeOrInsertPos(ID, pos)) {
+    ++NumTermsShared;
+    return T;
+  }
+
+  auto *T = create(op, width);
+  T->param0 = param0;
+  T->param1 = param1;
+  T->numOps = ops.size();
+  std::copy(ops.begin(), ops.end(), T->ops);
+  terms.InsertNode(T, pos);
+  return T;
+}
+
+const SMTTerm *SMTTermArena::getConst(const APInt &value) {
+  FoldingSetNodeID ID;
+  ID.AddInteger(SMT_CONST);
+  ID.AddInteger(value.getBitWidth());
+  ID.AddInteger(0);
+  ID.AddInteger(0);
+  value.Profile(ID);
+
+  void *pos;
+  if (auto *T = terms.FindNodeOrInsertPos(ID, pos)) {
+    ++NumTermsShared;
+    return T;
+  }
+
+  auto *T = create(SMT_CONST, value.getBitWidth());
+  T->value = value;
+  terms.InsertNode(T, pos);
+  return T;
+}
+
+const SMTTerm *SMTTermArena::getVar(unsigned width, StringRef name) {
+  auto *T = create(SMT_VAR, width);
+  T->name = name.empty() ? StringRef() : names.save(name);
+  return T;
+}
+
+APInt evaluateOp(SMTOp op, unsigned width, unsigned param1, ArrayRef<APInt> args) {
+  auto &a = args[0];
+  bool overflow = false;
+
+  switch (op) {
+  case SMT_NOT:
+    return ~a;
+  case SMT_NEG:
+    return -a;
+  case SMT_SEXT:
+    return a.sext(width);
+  case SMT_ZEXT:
+    return a.zext(width);
+  case SMT_SLICE:
+    return a.extractBits(width, param1);
+  case SMT_COND:
+    return a.getBoolValue() ? args[1] : args[2];
+  default:
+    break;
+  }
+
+  auto &b = args[1];
+  auto w = a.getBitWidth();
+
+  switch (op) {
+  case SMT_AND:
+    return a & b;
+  case SMT_OR:
+    return a | b;
+  case SMT_IMPLIES:
+    return ~a | b;
+  case SMT_XOR:
+    return a ^ b;
+  case SMT_CONCAT:
+    return a.concat(b);
+  case SMT_ADD:
+    return a + b;
+  case SMT_SUB:
+    return a - b;
+  case SMT_MUL:
+    return a * b;
+  case SMT_UDIV:
+    return b.isZero() ? APInt::getAllOnes(w) : a.udiv(b);
+  case SMT_UREM:
+    return b.isZero() ? a : a.urem(b);
+  case SMT_SDIV:
+    if (b.isZero())
+      return a.isNegative() ? APInt(w, 1) : APInt::getAllOnes(w);
+    // The one overflowing case wraps, as in SMT-LIB
+    return a.isMinSignedValue() && b.isAllOnes() ? a : a.sdiv(b);
+  case SMT_SREM:
+    if (b.isZero())
+      return a;
+    return a.isMinSignedValue() && b.isAllOnes() ? APInt(w, 0) : a.srem(b);
+  case SMT_SHL:
+    return b.uge(w) ? APInt(w, 0) : a.shl(b.getZExtValue());
+  case SMT_LSHR:
+    return b.uge(w) ? APInt(w, 0) : a.lshr(b.getZExtValue());
+  case SMT_ASHR:
+    return a.ashr(b.uge(w) ? w - 1 : b.getZExtValue());
+  case SMT_SADDO:
+    (void)a.sadd_ov(b, overflow);
+    break;
+  case SMT_UADDO:
+    (void)a.uadd_ov(b, overflow);
+    break;
+  case SMT_SSUBO:
+    (void)a.ssub_ov(b, overflow);
+    break;
+  case SMT_USUBO:
+    (void)a.usub_ov(b, overflow);
+    break;
+  case SMT_SMULO:
+    (void)a.smul_ov(b, overflow);
+    break;
+  case SMT_UMULO:
+    (void)a.umul_ov(b, overflow);
+    break;
+  case SMT_EQ:
+    return APInt(1, a == b);
+  case SMT_NE:
+    return APInt(1, a != b);
+  case SMT_UGT:
+    return APInt(1, a.ugt(b));
+  case SMT_UGE:
+    return APInt(1, a.uge(b));
+  case SMT_ULT:
+    return APInt(1, a.ult(b));
+  case SMT_ULE:
+    return APInt(1, a.ule(b));
+  case SMT_SGT:
+    return APInt(1, a.sgt(b));
+  case SMT_SGE:
+    return APInt(1, a.sge(b));
+  case SMT_SLT:
+    return APInt(1, a.slt(b));
+  case SMT_SLE:
+    return APInt(1, a.sle(b));
+  default:
+    llvm_unreachable("not an operator");
+  }
+  return APInt(1, overflow);
+}
+
+// Post-order over the DAG with an explicit stack, as path constraints nest
+// as deep as the function is long.
+APInt evaluate(const SMTTerm *Root, function_ref<bool(const SMTTerm *, APInt &)> leaf) {
+  DenseMap<const SMTTerm *, APInt> values;
+  SmallVector<std::pair<const SMTTerm *, bool>, 32> stack = { { Root, false } };
+
+  while (!stack.empty()) {
+    auto *T = stack.back().first;
+    bool expanded = stack.back().second;
+    if (values.count(T)) {
+      stack.pop_back();
+      continue;
+    }
+
+    if (!expanded) {
+      if (T->isConst()) {
+        values[T] = T->value;
+        stack.pop_back();
+        continue;
+      }
+      APInt V;
+      if (leaf(T, V)) {
+        values[T] = V;
+        stack.pop_back();
+        continue;
+      }
+      assert(T->op != SMT_VAR && "no value for a variable");
+      stack.back().second = true;
+      for (auto *Op: T->operands())
+        stack.emplace_back(Op, false);
+      continue;
+    }
+
+    SmallVector<APInt, 3> args;
+    for (auto *Op: T->operands())
+      args.push_back(values[Op]);
+    values[T] = evaluateOp(T->op, T->width, T->param1, args);
+    stack.pop_back();
+  }
+  return values[Root];
+}
+
+SMTCost estimateCost(const SMTTerm *Root) {
+  SMTCost C;
+  SmallPtrSet<const SMTTerm *, 32> visited;
+  SmallVector<const SMTTerm *, 32> worklist = { Root };
+
+  while (!worklist.empty()) {
+    auto *T = worklist.pop_back_val();
+    if (!visited.insert(T).second)
+      continue;
+    worklist.append(T->operands().begin(), T->operands().end());
+    ++C.nodes;
+
+    uint64_t w = T->width;
+    bool constOp = false;
+    for (auto *Op: T->operands()) {
+      w = std::max<uint64_t>(w, Op->width);
+      constOp |= Op->isConst();
+    }
+    C.maxWidth = std::max<unsigned>(C.maxWidth, w);
+
+    switch (T->op) {
+    case SMT_CONST:
+    case SMT_VAR:
+    case SMT_NOT:
+    case SMT_ZEXT:
+    case SMT_SEXT:
+    case SMT_SLICE:
+    case SMT_CONCAT:
+      // Wiring only
+      break;
+    case SMT_MUL:
+    case SMT_SMULO:
+    case SMT_UMULO:
+    case SMT_UDIV:
+    case SMT_SDIV:
+    case SMT_UREM:
+    case SMT_SREM:
+      if (constOp) {
+        C.gates += w * w / 4;
+      } else {
+        C.gates += w * w;
+        ++C.nonlinear;
+      }
+      break;
+    case SMT_SHL:
+    case SMT_LSHR:
+    case SMT_ASHR:
+      if (!T->ops[1]->isConst())
+        C.gates += w * Log2_64_Ceil(w);
+      break;
+    default:
+      C.gates += w;
+      break;
+    }
+  }
+  return C;
+}
+
+const SMTTerm *copyTerm(SMTTermArena &arena, const SMTTerm *Root,
+                        function_ref<const SMTTerm *(const SMTTerm *)> mapVar) {
+  DenseMap<const SMTTerm *, const SMTTerm *> copies;
+  SmallVector<std::pair<const SMTTerm *, bool>, 32> stack = { { Root, false } };
+
+  while (!stack.empty()) {
+    auto *T = stack.back().first;
+    if (copies.count(T)) {
+      stack.pop_back();
+      continue;
+    }
+    if (T->op == SMT_VAR || T->isConst()) {
+      copies[T] = T->isConst() ? arena.getConst(T->value) : mapVar(T);
+      stack.pop_back();
+      continue;
+    }
+    if (!stack.back().second) {
+      stack.back().second = true;
+      for (auto *Op: T->operands())
+        stack.emplace_back(Op, false);
+      continue;
+    }
+    const SMTTerm *ops[3];
+    for (unsigned i = 0; i < T->numOps; ++i)
+      ops[i] = copies[T->ops[i]];
+    copies[T] = arena.get(T->op, makeArrayRef(ops, T->numOps), T->param0, T->param1);
+    stack.pop_back();
+  }
+  return copies[Root];
+}
+
+// Terms in post-order, each as op, width, param0, param1, number of operands
+// and their indices, followed by the words of a constant or the length and
+// characters of a variable name. All fields are native 32-bit or 64-bit
+// words, since both ends run on the same host.
+namespace {
+
+struct TermWriter {
+  std::string &out;
+
+  void write(const void *data, size_t size) {
+    out.append(static_cast<const char *>(data), size);
+  }
+  void write32(uint32_t v) { write(&v, sizeof(v)); }
+};
+
+struct TermReader {
+  StringRef in;
+
+  bool read(void *data, size_t size) {
+    if (in.size() < size)
+      return false;
+    memcpy(data, in.data(), size);
+    in = in.drop_front(size);
+    return true;
+  }
+  bool read32(uint32_t &v) { return read(&v, sizeof(v)); }
+};
+
+} // anonymous namespace
+
+void serializeTerm(const SMTTerm *Root, std::string &out) {
+  DenseMap<const SMTTerm *, uint32_t> index;
+  SmallVector<const SMTTerm *, 64> order;
+  SmallVector<std::pair<const SMTTerm *, bool>, 32> stack = { { Root, false } };
+
+  while (!stack.empty()) {
+    auto *T = stack.back().first;
+    if (index.count(T)) {
+      stack.pop_back();
+      continue;
+    }
+    if (!stack.back().second) {
+      stack.back().second = true;
+      for (auto *Op: T->operands())
+        stack.emplace_back(Op, false);
+      continue;
+    }
+    index[T] = order.size();
+    order.push_back(T);
+    stack.pop_back();
+  }
+
+  TermWriter W{ out };
+  W.write32(order.size());
+  for (auto *T: order) {
+    W.write32(T->op);
+    W.write32(T->width);
+    W.write32(T->param0);
+    W.write32(T->param1);
+    W.write32(T->numOps);
+    for (auto *Op: T->operands())
+      W.write32(index.lookup(Op));
+    if (T->isConst())
+      W.write(T->value.getRawData(), T->value.getNumWords() * sizeof(uint64_t));
+    else if (T->op == SMT_VAR) {
+      W.write32(T->name.size());
+      W.write(T->name.data(), T->name.size());
+    }
+  }
+}
+
+const SMTTerm *deserializeTerm(SMTTermArena &arena, StringRef in) {
+  TermReader R{ in };
+  uint32_t count;
+  if (!R.read32(count) || !count)
+    return nullptr;
+
+  std::vector<const SMTTerm *> terms;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t op, width, param0, param1, numOps;
+    if (!R.read32(op) || !R.read32(width) || !R.read32(param0) || !R.read32(param1) ||
+        !R.read32(numOps) || op > SMT_LAST_OP || !width || numOps > 3)
+      return nullptr;
+
+    const SMTTerm *ops[3];
+    for (uint32_t j = 0; j < numOps; ++j) {
+      uint32_t idx;
+      if (!R.read32(idx) || idx >= terms.size())
+        return nullptr;
+      ops[j] = terms[idx];
+    }
+
+    if (op == SMT_CONST) {
+      SmallVector<uint64_t, 2> words((width + 63) / 64);
+      if (numOps || !R.read(words.data(), words.size() * sizeof(uint64_t)))
+        return nullptr;
+      terms.push_back(arena.getConst(APInt(width, words)));
+    } else if (op == SMT_VAR) {
+      uint32_t size;
+      if (numOps || !R.read32(size) || size > R.in.size())
+        return nullptr;
+      terms.push_back(arena.getVar(width, R.in.take_front(size)));
+      R.in = R.in.drop_front(size);
+    } else {
+      if (!numOps)
+        return nullptr;
+      auto *T = arena.get(static_cast<SMTOp>(op), makeArrayRef(ops, numOps), param0, param1);
+      if (T->width != width)
+        return nullptr;
+      terms.push_back(T);
+    }
+  }
+  return R.in.empty() ? terms.back() : nullptr;
+}
+
+static const char *getSMTLIB2Name(SMTOp op) {
+  switch (op) {
+  case SMT_NOT:  return "bvnot";
+  case SMT_NEG:  return "bvneg";
+  case SMT_AND:  return "bvand";
+  case SMT_OR:   return "bvor";
+  case SMT_XOR:  return "bvxor";
+  case SMT_ADD:  return "bvadd";
+  case SMT_SUB:  return "bvsub";
+  case SMT_MUL:  return "bvmul";
+  case SMT_UDIV: return "bvudiv";
+  case SMT_SDIV: return "bvsdiv";
+  case SMT_UREM: return "bvurem";
+  case SMT_SREM: return "bvsrem";
+  case SMT_SHL:  return "bvshl";
+  case SMT_LSHR: return "bvlshr";
+  case SMT_ASHR: return "bvashr";
+  case SMT_CONCAT: return "concat";
+  case SMT_EQ:   return "=";
+  case SMT_NE:   return "distinct";
+  case SMT_UGT:  return "bvugt";
+  case SMT_UGE:  return "bvuge";
+  case SMT_ULT:  return "bvult";
+  case SMT_ULE:  return "bvule";
+  case SMT_SGT:  return "bvsgt";
+  case SMT_SGE:  return "bvsge";
+  case SMT_SLT:  return "bvslt";
+  case SMT_SLE:  return "bvsle";
+  default:       return nullptr;
+  }
+}
+
+// The body of the definition of T, in terms of the names of its operands.
+// Overflow predicates have no SMT-LIB2 operator, so they are computed on
+// widened operands.
+static void printSMTLIB2Op(raw_ostream &OS, const SMTTerm *T, ArrayRef<std::string> ops) {
+  auto w = T->numOps ? T->ops[0]->width : 0;
+  StringRef a = ops.size() > 0 ? StringRef(ops[0]) : StringRef();
+  StringRef b = ops.size() > 1 ? StringRef(ops[1]) : StringRef();
+
+  switch (T->op) {
+  case SMT_IMPLIES:
+    OS << "(bvor (bvnot " << a << ") " << b << ")";
+    return;
+  case SMT_UADDO:
+    OS << "((_ extract " << w << " " << w << ") (bvadd ((_ zero_extend 1) " << a
+       << ") ((_ zero_extend 1) " << b << ")))";
+    return;
+  case SMT_SADDO:
+  case SMT_SSUBO:
+    // The two top bits of the widened result differ
+    OS << "(let ((r (" << (T->op == SMT_SADDO ? "bvadd" : "bvsub")
+       << " ((_ sign_extend 1) " << a << ") ((_ sign_extend 1) " << b << "))))"
+       << " (bvxor ((_ extract " << w << " " << w << ") r) ((_ extract "
+       << w - 1 << " " << w - 1 << ") r)))";
+    return;
+  case SMT_USUBO:
+    OS << "(ite (bvult " << a << " " << b << ") #b1 #b0)";
+    return;
+  case SMT_UMULO:
+    OS << "(ite (= ((_ extract " << 2 * w - 1 << " " << w << ") (bvmul ((_ zero_extend "
+       << w << ") " << a << ") ((_ zero_extend " << w << ") " << b << "))) (_ bv0 "
+       << w << ")) #b0 #b1)";
+    return;
+  case SMT_SMULO:
+    OS << "(let ((r (bvmul ((_ sign_extend " << w << ") " << a << ") ((_ sign_extend "
+       << w << ") " << b << ")))) (ite (= r ((_ sign_extend " << w << ") ((_ extract "
+       << w - 1 << " 0) r))) #b0 #b1))";
+    return;
+  case SMT_ZEXT:
+    OS << "((_ zero_extend " << T->param0 << ") " << a << ")";
+    return;
+  case SMT_SEXT:
+    OS << "((_ sign_extend " << T->param0 << ") " << a << ")";
+    return;
+  case SMT_SLICE:
+    OS << "((_ extract " << T->param0 << " " << T->param1 << ") " << a << ")";
+    return;
+  case SMT_COND:
+    OS << "(ite (= " << a << " #b1) " << b << " " << ops[2] << ")";
+    return;
+  default:
+    break;
+  }
+
+  auto *name = getSMTLIB2Name(T->op);
+  assert(name && "no SMT-LIB2 operator");
+  OS << "(" << name;
+  for (auto &Op: ops)
+    OS << " " << Op;
+  OS << ")";
+  // Predicates are Bool in SMT-LIB2
+  if (T->op >= SMT_EQ && T->op <= SMT_SLE)
+    OS << " #b1 #b0)";
+}
+
+void printSMTLIB2(raw_ostream &OS, ArrayRef<const SMTTerm *> assertions) {
+  DenseMap<const SMTTerm *, std::string> names;
+  SmallVector<std::pair<const SMTTerm *, bool>, 32> stack;
+
+  OS << "(set-logic QF_BV)\n";
+  for (auto *Root: assertions) {
+    stack.emplace_back(Root, false);
+    while (!stack.empty()) {
+      auto *T = stack.back().first;
+      if (names.count(T)) {
+        stack.pop_back();
+        continue;
+      }
+      if (!stack.back().second) {
+        stack.back().second = true;
+        for (auto *Op: T->operands())
+          stack.emplace_back(Op, false);
+        continue;
+      }
+      stack.pop_back();
+
+      auto &name = names[T];
+      if (T->isConst()) {
+        SmallString<20> str;
+        T->value.toStringUnsigned(str, 10);
+        name = ("(_ bv" + str + " " + Twine(T->width) + ")").str();
+        continue;
+      }
+
+      if (T->op == SMT_VAR) {
+        // Names of IR values may hold anything but these two.
+        std::string base = T->name.trim().str();
+        base.erase(std::remove_if(base.begin(), base.end(),
+                                  [](char c) { return c == '|' || c == '\\'; }),
+                   base.end());
+        name = ("|" + base + "!" + Twine(T->id) + "|").str();
+        OS << "(declare-fun " << name << " () (_ BitVec " << T->width << "))\n";
+        continue;
+      }
+
+      SmallVector<std::string, 3> ops;
+      for (auto *Op: T->operands())
+        ops.push_back(names.lookup(Op));
+      name = "t" + std::to_string(T->id);
+      OS << "(define-fun " << name << " () (_ BitVec " << T->width << ") ";
+      if (T->op >= SMT_EQ && T->op <= SMT_SLE)
+        OS << "(ite ";
+      printSMTLIB2Op(OS, T, ops);
+      OS << ")\n";
+    }
+  }
+
+  for (auto *Root: assertions)
+    OS << "(assert (= " << names.lookup(Root) << " #b1))\n";
+  OS << "(check-sat)\n(exit)\n";
+}
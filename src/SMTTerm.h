@@ -0,0 +1,153 @@
+#ifndef SMTTERM_H
+#define SMTTERM_H
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/FoldingSet.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdint>
+#include <string>
+
+enum SMTOp : uint8_t {
+  SMT_CONST,
+  SMT_VAR,
+  SMT_NOT,
+  SMT_NEG,
+  SMT_AND,
+  SMT_OR,
+  SMT_IMPLIES,
+  SMT_XOR,
+  SMT_ADD,
+  SMT_SUB,
+  SMT_MUL,
+  SMT_UDIV,
+  SMT_SDIV,
+  SMT_UREM,
+  SMT_SREM,
+  SMT_SHL,
+  SMT_LSHR,
+  SMT_ASHR,
+  SMT_SADDO,
+  SMT_UADDO,
+  SMT_SSUBO,
+  SMT_USUBO,
+  SMT_SMULO,
+  SMT_UMULO,
+  SMT_EQ,
+  SMT_NE,
+  SMT_UGT,
+  SMT_UGE,
+  SMT_ULT,
+  SMT_ULE,
+  SMT_SGT,
+  SMT_SGE,
+  SMT_SLT,
+  SMT_SLE,
+  SMT_ZEXT,
+  SMT_SEXT,
+  SMT_SLICE,
+  SMT_COND,
+  SMT_CONCAT,
+  SMT_LAST_OP = SMT_CONCAT,
+};
+
+// A bit-vector term, independent of any solver instance. Terms are immutable
+// and hash-consed by their arena, so structurally equal terms are the same
+// pointer. Booleans are terms of width 1.
+struct SMTTerm : public llvm::FoldingSetNode {
+  SMTOp op;
+  uint8_t numOps = 0;
+  unsigned width;
+  // Bits added by SMT_ZEXT/SMT_SEXT, upper and lower bit of SMT_SLICE
+  unsigned param0 = 0, param1 = 0;
+  // Creation order within the arena, unique
+  unsigned id;
+  const SMTTerm *ops[3] = {};
+  // SMT_CONST only
+  llvm::APInt value;
+  // SMT_VAR only, may be empty
+  llvm::StringRef name;
+
+  SMTTerm(SMTOp op, unsigned width, unsigned id) : op(op), width(width), id(id) {}
+
+  llvm::ArrayRef<const SMTTerm *> operands() const {
+    return llvm::makeArrayRef(ops, numOps);
+  }
+  bool isConst() const { return op == SMT_CONST; }
+
+  void Profile(llvm::FoldingSetNodeID &) const;
+};
+
+// Owns the terms of one or more SMTSolvers. Variables are always fresh, any
+// other term is shared with every structurally equal one built before it.
+class SMTTermArena {
+  llvm::SpecificBumpPtrAllocator<SMTTerm> allocator;
+  llvm::BumpPtrAllocator nameAllocator;
+  llvm::StringSaver names{nameAllocator};
+  llvm::FoldingSet<SMTTerm> terms;
+  unsigned numTerms = 0;
+
+  SMTTerm *create(SMTOp op, unsigned width);
+
+public:
+  SMTTermArena() = default;
+  SMTTermArena(const SMTTermArena &) = delete;
+  SMTTermArena &operator=(const SMTTermArena &) = delete;
+
+  const SMTTerm *get(SMTOp, llvm::ArrayRef<const SMTTerm *> ops,
+                     unsigned param0 = 0, unsigned param1 = 0);
+  const SMTTerm *getConst(const llvm::APInt &);
+  const SMTTerm *getVar(unsigned width, llvm::StringRef name);
+
+  unsigned size() const { return numTerms; }
+
+  static unsigned getResultWidth(SMTOp, llvm::ArrayRef<const SMTTerm *> ops,
+                                 unsigned param0, unsigned param1);
+};
+
+// The value of an operator term of the given width and lower slice bit on
+// constant operands
+llvm::APInt evaluateOp(SMTOp, unsigned width, unsigned param1,
+                       llvm::ArrayRef<llvm::APInt> args);
+// The value of T, given the values of the terms for which leaf returns true
+// (at least every variable below T). Division by zero follows SMT-LIB.
+llvm::APInt evaluate(const SMTTerm *T,
+                     llvm::function_ref<bool(const SMTTerm *, llvm::APInt &)> leaf);
+
+// T rebuilt in the given arena, with every variable below it replaced by
+// mapVar of that variable, which must already live in that arena
+const SMTTerm *copyTerm(SMTTermArena &, const SMTTerm *T,
+                        llvm::function_ref<const SMTTerm *(const SMTTerm *)> mapVar);
+
+// A self-contained byte string holding T and every term below it, for
+// handing a query to another process on the same host; variables are
+// identified by position only. deserializeTerm() recreates the terms in
+// the given arena, with fresh variables, or returns null if the input is
+// malformed.
+void serializeTerm(const SMTTerm *T, std::string &out);
+const SMTTerm *deserializeTerm(SMTTermArena &, llvm::StringRef in);
+
+// A rough size of the circuit a term is bit-blasted to, as a predictor of
+// how long it takes to solve
+struct SMTCost {
+  unsigned nodes = 0;
+  // Widest operand of any node
+  unsigned maxWidth = 0;
+  // Multiplications, divisions and remainders of two non-constant terms
+  unsigned nonlinear = 0;
+  // Linear operators cost their width, multipliers and dividers its square
+  // unless an operand is constant, variable shifts w log w.
+  uint64_t gates = 0;
+};
+SMTCost estimateCost(const SMTTerm *T);
+
+// A self-contained SMT-LIB2 script (QF_BV) asserting every given formula
+// and checking satisfiability. Booleans stay bit-vectors of width 1, and
+// variables are named after their name and creation order.
+void printSMTLIB2(llvm::raw_ostream &, llvm::ArrayRef<const SMTTerm *> assertions);
+
+#endif /* SMTTERM_H */
@@ -0,0 +1,316 @@
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Signals.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "SolverPool.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+STATISTIC(NumWorkerQueries,   "Number of queries solved by worker processes");
+STATISTIC(NumWorkersStarted,  "Number of solver worker processes started");
+STATISTIC(NumWorkersRecycled, "Number of solver workers replaced after their query or memory quota");
+STATISTIC(NumWorkerCrashes,   "Number of queries lost to a crashed solver worker");
+STATISTIC(NumWorkerTimeouts,  "Number of queries whose solver worker was killed for taking too long");
+STATISTIC(NumWorkerDeadline,  "Number of queries given up at the deadline of their batch");
+
+namespace {
+
+struct Reply {
+  uint8_t result;
+  // Resident set growth of the worker since it started
+  uint64_t rssKB;
+};
+
+} // anonymous namespace
+
+static double getTime() {
+  std::chrono::duration<double> t = std::chrono::steady_clock::now().time_since_epoch();
+  return t.count();
+}
+
+// Virtual and resident size of this process in bytes, from /proc
+static bool getMemoryUsage(uint64_t &vsize, uint64_t &rss) {
+  auto *F = fopen("/proc/self/statm", "r");
+  if (!F)
+    return false;
+  unsigned long long pages, resident;
+  bool ok = fscanf(F, "%llu %llu", &pages, &resident) == 2;
+  fclose(F);
+  auto pageSize = sysconf(_SC_PAGESIZE);
+  vsize = pages * pageSize;
+  rss = resident * pageSize;
+  return ok;
+}
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const char *>(data);
+  while (size) {
+    // A dead peer must not SIGPIPE us.
+    auto n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool readAll(int fd, void *data, size_t size) {
+  auto *p = static_cast<char *>(data);
+  while (size) {
+    auto n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Without a handler report_fatal_error would run the interrupt handlers,
+// which remove the parent's output files, and then exit().
+static void handleWorkerFatalError(void *, const char *reason, bool) {
+  errs() << "kint: solver worker: " << reason << "\n";
+  _exit(1);
+}
+
+// The worker side: solve length-prefixed serialized queries until the
+// parent closes its end. Never returns, and never runs the destructors and
+// exit handlers of the copy of the parent it is.
+[[noreturn]] static void runWorker(int fd, const SMTConfig &config, unsigned memoryMB) {
+  // A crash here must not print a stack trace or remove the output files
+  // of the parent, as opt's handlers would, nor be recovered from into the
+  // copy of a kint-server request.
+  sys::unregisterHandlers();
+  CrashRecoveryContext::Disable();
+  remove_fatal_error_handler();
+  install_fatal_error_handler(handleWorkerFatalError);
+
+  uint64_t vsize = 0, baseRSS = 0;
+  getMemoryUsage(vsize, baseRSS);
+  if (memoryMB) {
+    rlimit limit;
+    limit.rlim_cur = limit.rlim_max = vsize + (static_cast<uint64_t>(memoryMB) << 20);
+    setrlimit(RLIMIT_AS, &limit);
+  }
+
+  std::string query;
+  uint32_t size;
+  while (readAll(fd, &size, sizeof(size))) {
+    query.resize(size);
+    if (!readAll(fd, &query[0], size))
+      break;
+
+    Reply reply{ SOLVE_UNKNOWN, 0 };
+    {
+      auto arena = std::make_shared<SMTTermArena>();
+      if (auto *E = deserializeTerm(*arena, query)) {
+        SMTSolver solver(config, arena);
+        reply.result = solver.smt_query(E) ? SOLVE_SAT : SOLVE_UNSAT;
+      }
+    }
+
+    uint64_t rss;
+    if (getMemoryUsage(vsize, rss) && rss > baseRSS)
+      reply.rssKB = (rss - baseRSS) >> 10;
+    if (!writeAll(fd, &reply, sizeof(reply)))
+      break;
+  }
+  _exit(0);
+}
+
+SolverPool::SolverPool(unsigned numWorkers, const SMTConfig &config, unsigned memoryMB,
+                       unsigned timeout, unsigned maxQueries) :
+  workers(numWorkers), config(config), memoryMB(memoryMB), timeout(timeout),
+  maxQueries(maxQueries) {
+  // Fork while the parent is still small.
+  for (auto &W: workers)
+    spawn(W);
+}
+
+SolverPool::~SolverPool() {
+  for (auto &W: workers)
+    stop(W, W.job >= 0);
+}
+
+bool SolverPool::spawn(Worker &W) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+    return false;
+
+  auto pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (!pid) {
+    // Other workers only see EOF if the parent is the last one holding
+    // their socket.
+    close(fds[0]);
+    for (auto &Other: workers) {
+      if (Other.fd >= 0)
+        close(Other.fd);
+    }
+    runWorker(fds[1], config, memoryMB);
+  }
+
+  close(fds[1]);
+  W.pid = pid;
+  W.fd = fds[0];
+  W.queries = 0;
+  W.job = -1;
+  ++NumWorkersStarted;
+  return true;
+}
+
+// An idle worker exits once its socket is closed; a busy one is killed.
+void SolverPool::stop(Worker &W, bool kill) {
+  if (W.pid < 0)
+    return;
+  if (kill)
+    ::kill(W.pid, SIGKILL);
+  close(W.fd);
+  int status;
+  while (waitpid(W.pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  W.pid = -1;
+  W.fd = -1;
+  W.job = -1;
+}
+
+void SolverPool::solve(ArrayRef<SMTExpr> queries, MutableArrayRef<SolveResult> results,
+                       MutableArrayRef<double> seconds,
+                       std::chrono::steady_clock::time_point deadline) {
+  assert(queries.size() == results.size() && queries.size() == seconds.size());
+  size_t next = 0, pending = queries.size();
+  std::string message;
+  // In getTime() seconds, 0 if there is none
+  double end = 0;
+  if (deadline != std::chrono::steady_clock::time_point::max())
+    end = std::chrono::duration<double>(deadline.time_since_epoch()).count();
+
+  // A worker that died while idle is noticed here, and gets one
+  // replacement before the query is given up on.
+  auto dispatch = [&](Worker &W, size_t job) {
+    message.assign(sizeof(uint32_t), '\0');
+    serializeTerm(queries[job], message);
+    uint32_t size = message.size() - sizeof(uint32_t);
+    message.replace(0, sizeof(size), reinterpret_cast<const char *>(&size), sizeof(size));
+
+    for (unsigned attempt = 0; attempt < 2; ++attempt) {
+      if (W.pid < 0 && !spawn(W))
+        return false;
+      if (writeAll(W.fd, message.data(), message.size())) {
+        W.job = job;
+        W.start = getTime();
+        ++NumWorkerQueries;
+        return true;
+      }
+      stop(W, true);
+    }
+    return false;
+  };
+
+  auto finish = [&](Worker &W, SolveResult result, double now) {
+    results[W.job] = result;
+    seconds[W.job] = now - W.start;
+    W.job = -1;
+    --pending;
+  };
+
+  while (pending) {
+    if (end && getTime() >= end) {
+      for (; next < queries.size(); ++next) {
+        results[next] = SOLVE_UNKNOWN;
+        seconds[next] = 0;
+        --pending;
+        ++NumWorkerDeadline;
+      }
+    }
+    for (auto &W: workers) {
+      while (W.job < 0 && next < queries.size()) {
+        auto job = next++;
+        if (dispatch(W, job))
+          break;
+        results[job] = SOLVE_UNKNOWN;
+        seconds[job] = 0;
+        --pending;
+      }
+    }
+    if (!pending)
+      break;
+
+    // Wait for a reply, or until the first deadline
+    SmallVector<pollfd, 8> fds;
+    SmallVector<Worker *, 8> busy;
+    auto now = getTime();
+    int wait = -1;
+    if (end)
+      wait = std::max(static_cast<int>((end - now) * 1000) + 1, 0);
+    for (auto &W: workers) {
+      if (W.job < 0)
+        continue;
+      fds.push_back(pollfd{ W.fd, POLLIN, 0 });
+      busy.push_back(&W);
+      if (timeout) {
+        auto left = static_cast<int>((W.start + timeout - now) * 1000) + 1;
+        if (left < 0)
+          left = 0;
+        if (wait < 0 || left < wait)
+          wait = left;
+      }
+    }
+    if (busy.empty())
+      report_fatal_error("kint: no solver worker could be started", false);
+    if (poll(fds.data(), fds.size(), wait) < 0 && errno != EINTR)
+      report_fatal_error("kint: poll on solver workers failed", false);
+
+    now = getTime();
+    for (size_t i = 0; i < busy.size(); ++i) {
+      auto &W = *busy[i];
+      if (fds[i].revents) {
+        Reply reply;
+        if (!readAll(W.fd, &reply, sizeof(reply)) || reply.result > SOLVE_UNKNOWN) {
+          ++NumWorkerCrashes;
+          finish(W, SOLVE_UNKNOWN, now);
+          stop(W, true);
+          continue;
+        }
+        finish(W, static_cast<SolveResult>(reply.result), now);
+        ++W.queries;
+        if ((maxQueries && W.queries >= maxQueries) ||
+            (memoryMB && reply.rssKB >= (static_cast<uint64_t>(memoryMB) << 10) / 2)) {
+          ++NumWorkersRecycled;
+          stop(W, false);
+        }
+      } else if (timeout && now - W.start >= timeout) {
+        ++NumWorkerTimeouts;
+        finish(W, SOLVE_UNKNOWN, now);
+        stop(W, true);
+      } else if (end && now >= end) {
+        ++NumWorkerDeadline;
+        finish(W, SOLVE_UNKNOWN, now);
+        stop(W, true);
+      }
+    }
+  }
+}
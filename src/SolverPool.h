@@ -0,0 +1,61 @@
+#ifndef SOLVERPOOL_H
+#define SOLVERPOOL_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <chrono>
+#include <string>
+#include <sys/types.h>
+#include "SMTSolver.h"
+
+enum SolveResult {
+  SOLVE_UNSAT,
+  SOLVE_SAT,
+  // The worker crashed, ran out of memory or time
+  SOLVE_UNKNOWN,
+};
+
+// Solves queries in forked worker processes, so that a solver running out
+// of memory or aborting loses one query rather than the whole run. Each
+// worker may map memoryMB on top of what it inherits from the parent,
+// enforced with RLIMIT_AS, and is killed once a query takes more than
+// timeout seconds. Workers are replaced after maxQueries queries, or once
+// their resident set passes half their limit, which returns the memory of
+// the solver library to the OS.
+class SolverPool {
+  struct Worker {
+    pid_t pid = -1;
+    // Our end of a socketpair with the worker
+    int fd = -1;
+    unsigned queries = 0;
+    // Index of the query being solved, or -1 when idle
+    int job = -1;
+    double start = 0;
+  };
+
+  llvm::SmallVector<Worker, 8> workers;
+  SMTConfig config;
+  unsigned memoryMB, timeout, maxQueries;
+
+  bool spawn(Worker &);
+  void stop(Worker &, bool kill);
+
+public:
+  // timeout and maxQueries of 0 mean unlimited.
+  SolverPool(unsigned numWorkers, const SMTConfig &config, unsigned memoryMB,
+             unsigned timeout, unsigned maxQueries);
+  ~SolverPool();
+
+  SolverPool(const SolverPool &) = delete;
+  SolverPool &operator=(const SolverPool &) = delete;
+
+  // Solve every query, as many at a time as there are workers, and store
+  // their results and solve times in query order. Queries are handed out in
+  // order, and those still unsolved at the deadline are unknown.
+  void solve(llvm::ArrayRef<SMTExpr> queries, llvm::MutableArrayRef<SolveResult> results,
+             llvm::MutableArrayRef<double> seconds,
+             std::chrono::steady_clock::time_point deadline =
+               std::chrono::steady_clock::time_point::max());
+};
+
+#endif /* SOLVERPOOL_H */
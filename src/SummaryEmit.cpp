@@ -0,0 +1,127 @@
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LazyValueInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include "KintChecks.h"
+#include "SummaryIndex.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+static cl::opt<std::string> SummaryOut("kint-summary-out",
+  cl::desc("File to write the summary index of this module to"),
+  cl::value_desc("file"), cl::init("-"));
+
+STATISTIC(NumFunctionsSummarized, "Number of functions written to the summary index");
+
+namespace {
+
+// Records, per externally visible function, the range of its return value
+// and the ranges of the arguments passed to it by this module. Indexes of all modules of a program are then
+// handed to -kint-smt-query through -kint-summary-index.
+struct SummaryEmit : public FunctionPass {
+  static char ID; // Pass identification
+  SummaryEmit() : FunctionPass(ID) {}
+
+  bool doInitialization(Module &);
+  bool runOnFunction(Function &);
+  bool doFinalization(Module &);
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LazyValueInfoWrapperPass>();
+    AU.setPreservesAll();
+  }
+
+private:
+  SummaryIndex index;
+
+  static bool isIndexed(const Function *F) {
+    return F && !F->hasLocalLinkage() && !F->isIntrinsic() && !matchKintFunc(F);
+  }
+};
+
+} // End anonymous namespace
+
+char SummaryEmit::ID = 0;
+
+static RegisterPass<SummaryEmit> X("kint-summary-emit",
+          "Per-module summary index for Kint",
+          false /* does not modify the CFG */,
+          true /* analysis */);
+
+bool SummaryEmit::doInitialization(Module &M) {
+  index = SummaryIndex();
+
+  for (auto &F: M) {
+    if (isIndexed(&F) && F.hasAddressTaken())
+      index.getOrCreate(F.getName()).addressTaken = true;
+  }
+  return false;
+}
+
+bool SummaryEmit::runOnFunction(Function &F) {
+  auto &LVI = getAnalysis<LazyValueInfoWrapperPass>().getLVI();
+
+  for (auto &BB: F) {
+    for (auto &I: BB) {
+      // Invokes count as direct calls for hasAddressTaken() too.
+      auto *CB = dyn_cast<CallBase>(&I);
+      auto *Callee = CB ? CB->getCalledFunction() : nullptr;
+      if (!isIndexed(Callee) || CB->arg_size() != Callee->arg_size())
+        continue;
+
+      FunctionFacts site;
+      site.calls = 1;
+      for (auto &V: CB->args()) {
+        if (V->getType()->isIntegerTy())
+          site.args.push_back(LVI.getConstantRange(V, CB));
+        else
+          site.args.emplace_back(1, true);
+      }
+      index.getOrCreate(Callee->getName()).merge(site);
+    }
+  }
+
+  if (!isIndexed(&F))
+    return false;
+
+  FunctionFacts def;
+  def.defs = 1;
+  auto *RetTy = F.getReturnType();
+  bool first = true;
+
+  for (auto &BB: F) {
+    auto *RI = dyn_cast<ReturnInst>(BB.getTerminator());
+    if (!RI || !RI->getReturnValue())
+      continue;
+
+    if (!RetTy->isIntegerTy())
+      continue;
+
+    auto *V = RI->getReturnValue();
+    auto CR = LVI.getConstantRange(V, RI);
+    def.ret = first ? CR : def.ret.unionWith(CR);
+    first = false;
+  }
+
+  index.getOrCreate(F.getName()).merge(def);
+  ++NumFunctionsSummarized;
+  return false;
+}
+
+bool SummaryEmit::doFinalization(Module &M) {
+  std::error_code EC;
+  raw_fd_ostream OS(SummaryOut, EC, sys::fs::OF_Text);
+  if (EC)
+    report_fatal_error(Twine("cannot write summary index '") + SummaryOut + "': " +
+                       EC.message(), false);
+  index.write(OS);
+  return false;
+}
@@ -0,0 +1,154 @@
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include "SummaryIndex.h"
+
+using namespace llvm;
+
+static const int64_t IndexVersion = 1;
+
+static ConstantRange unionRanges(const ConstantRange &a, const ConstantRange &b) {
+  if (a.getBitWidth() != b.getBitWidth())
+    return ConstantRange(a.getBitWidth(), true);
+  return a.unionWith(b);
+}
+
+void FunctionFacts::merge(const FunctionFacts &other) {
+  if (!defs)
+    ret = other.ret;
+  else if (other.defs)
+    ret = unionRanges(ret, other.ret);
+
+  if (!calls) {
+    args = other.args;
+  } else if (other.calls) {
+    if (args.size() != other.args.size())
+      args.clear();
+    for (size_t i = 0; i < args.size(); ++i)
+      args[i] = unionRanges(args[i], other.args[i]);
+  }
+
+  defs += other.defs;
+  calls += other.calls;
+  addressTaken |= other.addressTaken;
+}
+
+const FunctionFacts *SummaryIndex::lookup(StringRef name) const {
+  auto it = functions.find(name);
+  return it == functions.end() ? nullptr : &it->second;
+}
+
+void SummaryIndex::merge(const SummaryIndex &other) {
+  for (auto &KV: other.functions)
+    functions[KV.getKey()].merge(KV.getValue());
+}
+
+// A range is written as its bit width and half-open [lo, hi) bounds in
+// decimal, or null if it is the full set.
+static json::Value rangeToJSON(const ConstantRange &CR) {
+  if (CR.isFullSet())
+    return nullptr;
+  return json::Object{
+    {"bits", CR.getBitWidth()},
+    {"lo", toString(CR.getLower(), 10, false)},
+    {"hi", toString(CR.getUpper(), 10, false)},
+  };
+}
+
+static bool rangeFromJSON(const json::Value *V, ConstantRange &CR) {
+  if (!V || V->getAsNull())
+    return true;
+
+  auto *O = V->getAsObject();
+  if (!O)
+    return false;
+  auto bits = O->getInteger("bits");
+  auto lo = O->getString("lo");
+  auto hi = O->getString("hi");
+  if (!bits || *bits <= 0 || !lo || !hi)
+    return false;
+
+  APInt L, H;
+  if (lo->getAsInteger(10, L) || hi->getAsInteger(10, H))
+    return false;
+  L = L.zextOrTrunc(*bits);
+  H = H.zextOrTrunc(*bits);
+  CR = L == H ? ConstantRange(*bits, L.isMaxValue()) : ConstantRange(L, H);
+  return true;
+}
+
+bool SummaryIndex::load(StringRef path, std::string &err) {
+  auto buf = MemoryBuffer::getFile(path);
+  if (!buf) {
+    err = buf.getError().message();
+    return false;
+  }
+
+  auto parsed = json::parse((*buf)->getBuffer());
+  if (!parsed) {
+    err = toString(parsed.takeError());
+    return false;
+  }
+
+  auto *root = parsed->getAsObject();
+  auto *funcs = root ? root->getObject("functions") : nullptr;
+  if (!root || root->getInteger("version") != IndexVersion || !funcs) {
+    err = "not a version " + std::to_string(IndexVersion) + " summary index";
+    return false;
+  }
+
+  SummaryIndex index;
+  for (auto &KV: *funcs) {
+    auto *O = KV.second.getAsObject();
+    if (!O) {
+      err = "bad entry for " + KV.first.str();
+      return false;
+    }
+
+    FunctionFacts facts;
+    facts.defs = O->getInteger("defs").getValueOr(0);
+    facts.calls = O->getInteger("calls").getValueOr(0);
+    facts.addressTaken = O->getBoolean("addressTaken").getValueOr(true);
+    bool ok = rangeFromJSON(O->get("ret"), facts.ret);
+    if (auto *args = O->getArray("args")) {
+      for (auto &A: *args) {
+        facts.args.emplace_back(1, true);
+        ok = ok && rangeFromJSON(&A, facts.args.back());
+      }
+    }
+    if (!ok) {
+      err = "bad range for " + KV.first.str();
+      return false;
+    }
+    index.getOrCreate(KV.first).merge(facts);
+  }
+
+  merge(index);
+  return true;
+}
+
+void SummaryIndex::write(raw_ostream &OS) const {
+  json::Object funcs;
+  for (auto &KV: functions) {
+    auto &facts = KV.getValue();
+    json::Array args;
+    for (auto &CR: facts.args)
+      args.push_back(rangeToJSON(CR));
+
+    funcs[KV.getKey()] = json::Object{
+      {"defs", facts.defs},
+      {"calls", facts.calls},
+      {"addressTaken", facts.addressTaken},
+      {"ret", rangeToJSON(facts.ret)},
+      {"args", std::move(args)},
+    };
+  }
+
+  json::Value root = json::Object{
+    {"version", IndexVersion},
+    {"functions", std::move(funcs)},
+  };
+  OS << formatv("{0:2}", root) << '\n';
+}
@@ -0,0 +1,48 @@
+#ifndef SUMMARYINDEX_H
+#define SUMMARYINDEX_H
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/ConstantRange.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdint>
+#include <string>
+
+// What the modules of a program know about one externally visible function.
+// Facts from several modules are merged, so each one holds for every
+// definition and call site seen so far.
+struct FunctionFacts {
+  // Union over every return, full if unknown or not an integer
+  llvm::ConstantRange ret;
+  // Union over every direct call site, full if unknown or not an integer
+  llvm::SmallVector<llvm::ConstantRange, 4> args;
+  unsigned defs = 0;
+  unsigned calls = 0;
+  bool addressTaken = false;
+
+  FunctionFacts() : ret(1, true) {}
+
+  void merge(const FunctionFacts &);
+  // Argument ranges describe every caller only if all of them were seen.
+  bool knowsArgs() const { return calls && !addressTaken; }
+};
+
+// A serialized (JSON) map from function name to its facts, written per module
+// by -kint-summary-emit and read back, merged, by -kint-smt-query.
+class SummaryIndex {
+  llvm::StringMap<FunctionFacts> functions;
+
+public:
+  bool empty() const { return functions.empty(); }
+
+  FunctionFacts &getOrCreate(llvm::StringRef name) { return functions[name]; }
+  const FunctionFacts *lookup(llvm::StringRef name) const;
+
+  void merge(const SummaryIndex &);
+  // Returns false and sets err if path cannot be read or parsed.
+  bool load(llvm::StringRef path, std::string &err);
+  void write(llvm::raw_ostream &) const;
+};
+
+#endif /* SUMMARYINDEX_H */
@@ -0,0 +1,320 @@
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <string>
+#include <vector>
+#include "KintChecks.h"
+
+#define DEBUG_TYPE "kint"
+
+using namespace llvm;
+
+static cl::list<std::string> TaintSources("kint-taint-source", cl::CommaSeparated,
+  cl::desc("Untrusted input, as <function>:ret for its return value, "
+           "<function>:arg<n> for the memory its n-th argument points to, or "
+           "<function>:params for the parameters of its definition; a "
+           "trailing * in the name matches any suffix (default: read and "
+           "recv buffers, getenv, copy_from_user, main and sys_*)"),
+  cl::value_desc("spec"));
+
+static cl::list<std::string> TaintSinks("kint-taint-sink", cl::CommaSeparated,
+  cl::desc("Where an error in untrusted data is most urgent, as "
+           "<function>:arg<n> (default: allocation sizes and memory copy "
+           "lengths)"),
+  cl::value_desc("spec"));
+
+static const char *const DefaultSources[] = {
+  "read:arg1", "pread:arg1", "recv:arg1", "recvfrom:arg1", "recvmsg:arg1",
+  "fread:arg0", "fgets:arg0", "getenv:ret", "copy_from_user:arg0",
+  "main:params", "sys_*:params",
+};
+
+static const char *const DefaultSinks[] = {
+  "malloc:arg0", "calloc:arg0", "calloc:arg1", "realloc:arg1",
+  "kmalloc:arg0", "kzalloc:arg0", "vmalloc:arg0",
+  "memcpy:arg2", "memmove:arg2", "memset:arg2",
+  "llvm.memcpy*:arg2", "llvm.memmove*:arg2", "llvm.memset*:arg2",
+  "copy_from_user:arg2", "copy_to_user:arg2",
+};
+
+STATISTIC(NumTaintedChecks, "Number of checks on operations depending on untrusted input");
+STATISTIC(NumSinkChecks,    "Number of tainted checks whose result reaches a taint sink");
+
+namespace {
+
+// A function and where taint enters or is sought at its calls
+struct TaintSpec {
+  enum Kind { RET, ARG, PARAMS };
+
+  std::string name;
+  // The name ended in '*'
+  bool prefix = false;
+  Kind kind = RET;
+  unsigned arg = 0;
+
+  static bool parse(StringRef, TaintSpec &);
+
+  bool matches(const Function *F) const {
+    return prefix ? F->getName().startswith(name) : F->getName() == name;
+  }
+};
+
+// Marks the checks of the module whose operation depends on untrusted
+// input, so that -kint-smt-query can solve them first or only them. Taint
+// is propagated flow-insensitively to a fixpoint over the whole module:
+// along SSA uses, through memory, tracked per underlying object, and
+// through the arguments and return values of calls. A pointer loaded from
+// untrusted memory points to untrusted memory, as argv does.
+struct TaintAnalysis : public ModulePass {
+  static char ID; // Pass identification
+  TaintAnalysis() : ModulePass(ID) {}
+
+  bool runOnModule(Module &);
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.setPreservesCFG();
+  }
+
+private:
+  std::vector<TaintSpec> sources, sinks;
+  // Values depending on untrusted input
+  DenseSet<const Value *> tainted;
+  // Underlying objects holding untrusted data
+  DenseSet<const Value *> taintedMem;
+  // Functions that may return untrusted data
+  SmallPtrSet<const Function *, 16> taintedRet;
+
+  bool taint(const Value *V) { return tainted.insert(V).second; }
+  bool taintMem(const Value *Ptr) {
+    return taintedMem.insert(getUnderlyingObject(Ptr)).second;
+  }
+  bool isTaintedMem(const Value *Ptr) const {
+    auto *Obj = getUnderlyingObject(Ptr);
+    return taintedMem.count(Obj) || (isa<LoadInst>(Obj) && tainted.count(Obj));
+  }
+  bool visit(Instruction &);
+  bool visitCall(CallBase &);
+  void findSinkValues(Function &, SmallPtrSetImpl<const Value *> &);
+  static void parseSpecs(ArrayRef<std::string>, ArrayRef<const char *>,
+                         std::vector<TaintSpec> &, const char *option);
+};
+
+} // End anonymous namespace
+
+char TaintAnalysis::ID = 0;
+
+static RegisterPass<TaintAnalysis> X("kint-taint",
+          "Taint analysis from untrusted input for Kint",
+          false /* does not modify the CFG */,
+          false /* transformation, not just analysis */);
+
+bool TaintSpec::parse(StringRef str, TaintSpec &S) {
+  StringRef name, where;
+  std::tie(name, where) = str.trim().rsplit(':');
+  if (name.empty() || where.empty())
+    return false;
+
+  S.prefix = name.endswith("*");
+  S.name = name.drop_back(S.prefix).str();
+  if (where == "ret") {
+    S.kind = RET;
+  } else if (where == "params") {
+    S.kind = PARAMS;
+  } else if (where.consume_front("arg") && !where.getAsInteger(10, S.arg)) {
+    S.kind = ARG;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void TaintAnalysis::parseSpecs(ArrayRef<std::string> strs, ArrayRef<const char *> defaults,
+                               std::vector<TaintSpec> &specs, const char *option) {
+  specs.clear();
+  SmallVector<StringRef, 16> all(strs.begin(), strs.end());
+  if (all.empty())
+    all.append(defaults.begin(), defaults.end());
+
+  for (auto str: all) {
+    TaintSpec S;
+    if (!TaintSpec::parse(str, S))
+      report_fatal_error(Twine("invalid ") + option + " '" + str + "'", false);
+    specs.push_back(S);
+  }
+}
+
+bool TaintAnalysis::runOnModule(Module &M) {
+  parseSpecs(TaintSources, DefaultSources, sources, "-kint-taint-source");
+  parseSpecs(TaintSinks, DefaultSinks, sinks, "-kint-taint-sink");
+  for (auto &S: sinks) {
+    if (S.kind != TaintSpec::ARG)
+      report_fatal_error("-kint-taint-sink only takes <function>:arg<n>", false);
+  }
+
+  tainted.clear();
+  taintedMem.clear();
+  taintedRet.clear();
+
+  for (auto &F: M) {
+    if (F.isDeclaration())
+      continue;
+    for (auto &S: sources) {
+      if (S.kind != TaintSpec::PARAMS || !S.matches(&F))
+        continue;
+      for (auto &A: F.args()) {
+        taint(&A);
+        if (A.getType()->isPointerTy())
+          taintMem(&A);
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &F: M) {
+      for (auto &BB: F) {
+        for (auto &I: BB)
+          changed |= visit(I);
+      }
+    }
+  }
+
+  auto &Ctx = M.getContext();
+  auto *Mark = MDNode::get(Ctx, None);
+  CheckedInstFinder checkedInsts;
+  for (auto &F: M) {
+    SmallPtrSet<const Value *, 32> sinkValues;
+    findSinkValues(F, sinkValues);
+
+    for (auto &BB: F) {
+      for (auto &I: BB) {
+        if (!matchKintCheck(&I))
+          continue;
+        auto *CI = cast<CallInst>(&I);
+        auto *Checked = checkedInsts.get(CI);
+        bool isTainted = tainted.count(Checked);
+        bool isSink = isTainted && sinkValues.count(Checked);
+        CI->setMetadata(KINT_TAINT_MD, isTainted ? Mark : nullptr);
+        CI->setMetadata(KINT_SINK_MD, isSink ? Mark : nullptr);
+        NumTaintedChecks += isTainted;
+        NumSinkChecks += isSink;
+      }
+    }
+  }
+
+  M.getOrInsertNamedMetadata(KINT_TAINT_MD);
+  return true;
+}
+
+bool TaintAnalysis::visit(Instruction &I) {
+  if (auto *CB = dyn_cast<CallBase>(&I))
+    return visitCall(*CB);
+  if (auto *LI = dyn_cast<LoadInst>(&I))
+    return isTaintedMem(LI->getPointerOperand()) && taint(LI);
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return tainted.count(SI->getValueOperand()) && taintMem(SI->getPointerOperand());
+  if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+    auto *V = RI->getReturnValue();
+    return V && tainted.count(V) && taintedRet.insert(I.getFunction()).second;
+  }
+
+  for (auto &Op: I.operands()) {
+    if (tainted.count(Op))
+      return taint(&I);
+  }
+  return false;
+}
+
+bool TaintAnalysis::visitCall(CallBase &CB) {
+  auto *F = CB.getCalledFunction();
+  if (F && matchKintFunc(F))
+    return false;
+
+  bool changed = false;
+  if (F) {
+    for (auto &S: sources) {
+      if (!S.matches(F))
+        continue;
+      if (S.kind == TaintSpec::RET)
+        changed |= taint(&CB);
+      else if (S.kind == TaintSpec::ARG && S.arg < CB.arg_size())
+        changed |= taintMem(CB.getArgOperand(S.arg));
+    }
+  }
+
+  if (auto *MT = dyn_cast<MemTransferInst>(&CB)) {
+    if (isTaintedMem(MT->getRawSource()))
+      changed |= taintMem(MT->getRawDest());
+    return changed;
+  }
+
+  // Without its body, the result of a call depends on all its arguments.
+  if (!F || F->isDeclaration()) {
+    for (auto &Op: CB.args()) {
+      if (tainted.count(Op))
+        return taint(&CB) || changed;
+    }
+    return changed;
+  }
+
+  for (auto &A: F->args()) {
+    if (A.getArgNo() >= CB.arg_size())
+      break;
+    auto *Actual = CB.getArgOperand(A.getArgNo());
+    if (tainted.count(Actual))
+      changed |= taint(&A);
+    if (Actual->getType()->isPointerTy()) {
+      if (isTaintedMem(Actual))
+        changed |= taintMem(&A);
+      if (taintedMem.count(&A))
+        changed |= taintMem(Actual);
+    }
+  }
+  if (taintedRet.count(F))
+    changed |= taint(&CB);
+  return changed;
+}
+
+// Everything within the function that a sink argument is computed from, up
+// to loads and calls
+void TaintAnalysis::findSinkValues(Function &F, SmallPtrSetImpl<const Value *> &values) {
+  SmallVector<const Value *, 32> worklist;
+
+  for (auto &BB: F) {
+    for (auto &I: BB) {
+      if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+        if (AI->isArrayAllocation())
+          worklist.push_back(AI->getArraySize());
+        continue;
+      }
+      auto *CB = dyn_cast<CallBase>(&I);
+      auto *Callee = CB ? CB->getCalledFunction() : nullptr;
+      if (!Callee)
+        continue;
+      for (auto &S: sinks) {
+        if (S.matches(Callee) && S.arg < CB->arg_size())
+          worklist.push_back(CB->getArgOperand(S.arg));
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    auto *V = worklist.pop_back_val();
+    auto *I = dyn_cast<Instruction>(V);
+    if (!I || !values.insert(I).second)
+      continue;
+    if (isa<LoadInst>(I) || isa<CallBase>(I))
+      continue;
+    worklist.append(I->op_begin(), I->op_end());
+  }
+}
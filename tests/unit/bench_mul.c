@@ -0,0 +1,37 @@
+// Multiply/divide heavy 64-bit code, see `make bench_mul`.
+#include <stdint.h>
+
+uint64_t area(uint64_t w, uint64_t h)
+{
+  if (w >= (1ULL << 32) || h >= (1ULL << 32))
+    return 0;
+  return w * h;
+}
+
+int64_t scale(int64_t x, int64_t num, int64_t den)
+{
+  if (den == 0)
+    return 0;
+  return x * num / den;
+}
+
+uint64_t split(uint64_t x, uint64_t y)
+{
+  if (y < 2)
+    return 0;
+  uint64_t q = x / y;
+  uint64_t r = x % y;
+  return q * y + r - x;
+}
+
+uint64_t poly(uint64_t a, uint64_t b, uint64_t c)
+{
+  return a * a * b + b * b * c + c * c * a;
+}
+
+int64_t mean(int64_t sum, int64_t count)
+{
+  if (count <= 0)
+    return 0;
+  return (sum / count) * count + sum % count;
+}
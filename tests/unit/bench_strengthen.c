@@ -0,0 +1,28 @@
+// Numeric kernels whose index arithmetic only becomes provably non-wrapping
+// with the path conditions the solver sees, see `make bench_strengthen`.
+
+void saxpy_offset(float *x, float *y, float a, unsigned n)
+{
+  if (n >= 1024)
+    return;
+  for (unsigned i = 0; i < n; i++)
+    y[i + 3] = a * x[i + 3] + y[i + 3];
+}
+
+void stencil(int *out, const int *in, int n)
+{
+  if (n <= 0 || n > 4096)
+    return;
+  for (int i = 1; i < n - 1; i++)
+    out[i] = (in[i - 1] + 2 * in[i] + in[i + 1]) / 4;
+}
+
+unsigned checksum(const unsigned char *buf, unsigned len)
+{
+  unsigned sum = 0;
+  if (len > 65536)
+    return 0;
+  for (unsigned i = 0; i < len; i += 2)
+    sum += (buf[i] << 8) | buf[i + 1];
+  return sum;
+}
@@ -0,0 +1,26 @@
+// Checks limited to the lines test_diff.diff changes, see `make test_diff`.
+#include "test_diff.h"
+
+// Error: changed line, found through the b/ prefix and the source directory
+int changed(int x)
+{
+  return x + 1;
+}
+
+// No error: not in the diff
+int untouched(int x)
+{
+  return x + 1;
+}
+
+// Error: follows the line a deletion-only hunk removed
+int shrunk(int x, int y)
+{
+  return x - y;
+}
+
+// Error: the inlined copy of twice() is on a line of a new file
+int inlined(int x)
+{
+  return twice(x);
+}
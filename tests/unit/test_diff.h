@@ -0,0 +1,5 @@
+// Added by test_diff.diff, see `make test_diff`.
+static inline __attribute__((always_inline)) int twice(int x)
+{
+  return x * 2;
+}
@@ -0,0 +1,47 @@
+// Checks merged and hoisted by -kint-check-elim, see `make test_elim`.
+// -stats counts the merged and hoisted checks.
+
+// Error: a + b may overflow. Its second check is dominated by the first,
+// identical one and merged into it, so it is reported once.
+int merge(int a, int b)
+{
+  int x = a + b;
+  int y = a + b;
+  return x ^ y;
+}
+
+// Error: k may be too large. The shift is invariant and runs on every trip
+// through the loop, so its check is hoisted out and solved once.
+int hoist(int x, int k, int n)
+{
+  int acc = 0;
+  int i = 0;
+  do {
+    acc ^= x << k;
+    i++;
+  } while (i < n);
+  return acc;
+}
+
+// No error: the sum only runs when both operands are small. The loop has
+// no exit and may spin without running it, so its check is not hoisted.
+void spin(unsigned a, unsigned b, unsigned *out)
+{
+  int ok = a < 1000 && b < 1000;
+  for (;;) {
+    if (ok)
+      *out = a + b;
+  }
+}
+
+// No error: as above, the sum is only reached under the condition, here
+// tested in the loop itself on every trip.
+unsigned guarded(unsigned a, unsigned b, int n)
+{
+  unsigned s = 0;
+  for (int i = 0; i < n; i++) {
+    if (a < 1000 && b < 1000)
+      s ^= a + b;
+  }
+  return s;
+}
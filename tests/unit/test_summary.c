@@ -0,0 +1,38 @@
+// Call results bounded by their callee, see `make test_summary`.
+static int min(int a, int b)
+{
+  return a < b ? a : b;
+}
+
+static int clamp(int x, int lo, int hi)
+{
+  if (x < lo)
+    return lo;
+  if (x > hi)
+    return hi;
+  return x;
+}
+
+// No error with -kint-call-summaries
+int scale(int x)
+{
+  return clamp(x, 0, 100) * 1000;
+}
+
+// No error with -kint-call-summaries
+int divide(int x)
+{
+  return 100 / clamp(x, 1, 5);
+}
+
+// Error: x may be INT_MIN
+int shrink(int x)
+{
+  return min(x, 10) - 5;
+}
+
+// Error: always divides by zero, needs -kint-call-summaries=2
+int zero(int x)
+{
+  return 100 / clamp(clamp(x, 1, 5), -5, 0);
+}
@@ -0,0 +1,37 @@
+// Errors on untrusted input, see `make test_taint`.
+#include <stdlib.h>
+#include <unistd.h>
+
+struct header {
+  unsigned count;
+  unsigned size;
+};
+
+static unsigned scale(unsigned x)
+{
+  return x * 4;
+}
+
+// Error, tainted and reaching a sink: count * size comes from the file
+void *load(int fd)
+{
+  struct header h;
+  if (read(fd, &h, sizeof(h)) != sizeof(h))
+    return 0;
+  return malloc(h.count * h.size);
+}
+
+// Error, tainted through the call to scale()
+unsigned entries(int fd)
+{
+  unsigned n;
+  if (read(fd, &n, sizeof(n)) != sizeof(n))
+    return 0;
+  return scale(n) + 1;
+}
+
+// Error, untainted: skipped with -kint-tainted-only
+unsigned area(unsigned w, unsigned h)
+{
+  return w * h;
+}
@@ -0,0 +1,91 @@
+// Operations of the GCC vector extension, see `make test_vector`.
+typedef int v4si __attribute__((vector_size(16)));
+typedef unsigned v4su __attribute__((vector_size(16)));
+
+// No error: every lane is below 256
+v4si lanes_safe(v4si a)
+{
+  a &= 255;
+  return a + a;
+}
+
+// Error: lanes 1 to 3 are not masked
+v4si lanes_error(v4si a)
+{
+  a &= (v4si){255, -1, -1, -1};
+  return a + a;
+}
+
+// No error: lane 0 is below 256
+int extract_safe(v4si a)
+{
+  a &= (v4si){255, -1, -1, -1};
+  return a[0] + 1;
+}
+
+// Error: lane 1 is not masked
+int extract_error(v4si a)
+{
+  a &= (v4si){255, -1, -1, -1};
+  return a[1] + 1;
+}
+
+// No error: lane 2 was set to 100
+int insert_safe(v4si a)
+{
+  a[2] = 100;
+  return a[2] * 1000;
+}
+
+// Error: lane 3 keeps its value
+int insert_error(v4si a)
+{
+  a[2] = 100;
+  return a[3] * 1000;
+}
+
+// No error: the masked value comes back out of lane 0
+int roundtrip_safe(int x)
+{
+  v4si v = {0, 0, 0, 0};
+  v[0] = x & 255;
+  return v[0] + 1;
+}
+
+// No error: every lane comes from the masked vector
+v4si shuffle_safe(v4si a, v4si b)
+{
+  v4si s = __builtin_shufflevector(a & 255, b, 3, 2, 1, 0);
+  return s + s;
+}
+
+// Error: lane 3 comes from b
+v4si shuffle_error(v4si a, v4si b)
+{
+  v4si s = __builtin_shufflevector(a & 255, b, 3, 2, 1, 4);
+  return s + s;
+}
+
+// No error: every amount is below 32
+v4su shift_safe(v4su a, v4su n)
+{
+  return a << (n & 31);
+}
+
+// Error: the amount of lane 3 may be 32 or more
+v4su shift_error(v4su a, v4su n)
+{
+  return a << (n & (v4su){31, 31, 31, 63});
+}
+
+// No error: no divisor is zero
+v4su div_safe(v4su a, v4su b)
+{
+  return a / (b | 1);
+}
+
+// Error: the divisor of lane 2 may be zero
+v4su div_error(v4su a, v4su b)
+{
+  return a / (b | (v4su){1, 1, 0, 1});
+}
@@ -0,0 +1,21 @@
+// Loops that -O2 vectorizes, see `make test_vector_loop`.
+
+// No error: a lane is below 100 or masked to 8 bits
+void select_safe(unsigned *restrict out, const unsigned *restrict a,
+                 const unsigned *restrict b, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    unsigned x = a[i], y = b[i] & 255;
+    out[i] = (x < 100 ? x : y) * 1000;
+  }
+}
+
+// Error: the lanes taken from a are 100 or more
+void select_error(unsigned *restrict out, const unsigned *restrict a,
+                  const unsigned *restrict b, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    unsigned x = a[i], y = b[i] & 255;
+    out[i] = (x < 100 ? y : x) * 1000;
+  }
+}
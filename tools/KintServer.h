@@ -0,0 +1,76 @@
+#ifndef KINTSERVER_H
+#define KINTSERVER_H
+
+// The protocol between kint-client and kint-server, over a Unix stream
+// socket on the same host, one request per connection. Integers are in host
+// byte order.
+//
+//   request: "KINT", u32 size, working directory, u32 count,
+//            count x (u32 size, argument), u32 size, module name,
+//            u64 size, bitcode or textual IR
+//   reply:   u32 exit status, u64 size, everything the run wrote to stderr
+//
+// The arguments are those of opt without the input file: pass names and
+// options, the latter only in -name=value form. The run takes place in the
+// working directory of the client, where its relative paths point.
+
+#include <llvm/ADT/StringRef.h>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+
+namespace kint_server {
+
+static const char Magic[4] = { 'K', 'I', 'N', 'T' };
+
+// Largest argument or module name accepted
+static const uint32_t MaxStringSize = 1 << 20;
+
+inline bool writeAll(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const char *>(data);
+  while (size) {
+    // A dead peer must not SIGPIPE us.
+    auto n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool readAll(int fd, void *data, size_t size) {
+  auto *p = static_cast<char *>(data);
+  while (size) {
+    auto n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+template <typename SizeT>
+bool writeString(int fd, llvm::StringRef str) {
+  SizeT size = str.size();
+  return writeAll(fd, &size, sizeof(size)) && writeAll(fd, str.data(), str.size());
+}
+
+template <typename SizeT>
+bool readString(int fd, std::string &str, uint64_t maxSize) {
+  SizeT size;
+  if (!readAll(fd, &size, sizeof(size)) || size > maxSize)
+    return false;
+  str.resize(size);
+  return !size || readAll(fd, &str[0], size);
+}
+
+} // namespace kint_server
+
+#endif /* KINTSERVER_H */
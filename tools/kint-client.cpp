@@ -0,0 +1,94 @@
+// Submits one module to kint-server and prints what the run wrote to
+// stderr, exiting with its status. Takes the arguments opt would, minus
+// -load, with the input file (or - for stdin) last:
+//
+//   kint-client -socket=/tmp/kint.sock -kint-check-insertion -kint-smt-query foo.bc
+//
+// The socket defaults to $KINT_SOCKET.
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "KintServer.h"
+
+using namespace llvm;
+using namespace kint_server;
+
+int main(int argc, char **argv) {
+  std::string path;
+  if (auto *env = getenv("KINT_SOCKET"))
+    path = env;
+
+  std::vector<StringRef> args;
+  for (int i = 1; i < argc; ++i) {
+    StringRef arg(argv[i]);
+    if (arg.consume_front("-socket=") || arg.consume_front("--socket="))
+      path = arg.str();
+    else
+      args.push_back(arg);
+  }
+  if (args.empty() || (args.back().startswith("-") && args.back() != "-")) {
+    errs() << "usage: kint-client [-socket=<path>] <opt arguments> <input file>\n";
+    return 1;
+  }
+  if (path.empty()) {
+    errs() << "kint-client: no -socket given and KINT_SOCKET not set\n";
+    return 1;
+  }
+
+  StringRef input = args.back();
+  args.pop_back();
+  auto buffer = MemoryBuffer::getFileOrSTDIN(input);
+  if (!buffer) {
+    errs() << "kint-client: cannot read '" << input << "': " << buffer.getError().message() << "\n";
+    return 1;
+  }
+
+  SmallString<256> cwd;
+  if (auto EC = sys::fs::current_path(cwd)) {
+    errs() << "kint-client: cannot get the working directory: " << EC.message() << "\n";
+    return 1;
+  }
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errs() << "kint-client: socket path too long\n";
+    return 1;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+    errs() << "kint-client: cannot connect to '" << path << "': " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  uint32_t count = args.size();
+  bool sent = writeAll(fd, Magic, sizeof(Magic)) && writeString<uint32_t>(fd, cwd) &&
+              writeAll(fd, &count, sizeof(count));
+  for (auto arg: args)
+    sent = sent && writeString<uint32_t>(fd, arg);
+  sent = sent && writeString<uint32_t>(fd, input) &&
+         writeString<uint64_t>(fd, (*buffer)->getBuffer());
+
+  uint32_t status;
+  std::string output;
+  if (!sent || !readAll(fd, &status, sizeof(status)) ||
+      !readString<uint64_t>(fd, output, UINT64_MAX)) {
+    errs() << "kint-client: the server dropped the request\n";
+    return 1;
+  }
+  close(fd);
+
+  errs() << output;
+  return status;
+}
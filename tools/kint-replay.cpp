@@ -0,0 +1,146 @@
+// Re-solves a corpus of SMT-LIB2 queries, as written by
+// -kint-slow-query-dir, under one or more solver configurations and reports
+// the time each query takes under each, so that solver settings can be
+// compared offline on the hard cases of real runs.
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "SMTSolver.h"
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(cl::Positional, cl::OneOrMore,
+  cl::desc("<query.smt2 | corpus directory>..."));
+
+static cl::list<std::string> Configs("config", cl::CommaSeparated,
+  cl::desc("Solver configurations to compare, as for -kint-portfolio "
+           "(default: fun)"),
+  cl::value_desc("engine[:rw<level>],..."));
+
+static cl::opt<unsigned> Repeat("repeat",
+  cl::desc("Solve every query this many times and keep the fastest"),
+  cl::value_desc("n"), cl::init(1));
+
+static const char *getResultName(int32_t result) {
+  switch (result) {
+  case BOOLECTOR_SAT:   return "sat";
+  case BOOLECTOR_UNSAT: return "unsat";
+  case BOOLECTOR_PARSE_ERROR: return "error";
+  default:              return "unknown";
+  }
+}
+
+// Directories contribute their .smt2 files, in name order.
+static bool collectQueries(std::vector<std::string> &queries) {
+  for (auto &input: Inputs) {
+    if (!sys::fs::is_directory(input)) {
+      queries.push_back(input);
+      continue;
+    }
+
+    std::vector<std::string> files;
+    std::error_code EC;
+    for (sys::fs::directory_iterator it(input, EC), end; it != end && !EC; it.increment(EC)) {
+      if (sys::path::extension(it->path()) == ".smt2")
+        files.push_back(it->path());
+    }
+    if (EC) {
+      errs() << "kint-replay: cannot read '" << input << "': " << EC.message() << "\n";
+      return false;
+    }
+    std::sort(files.begin(), files.end());
+    queries.insert(queries.end(), files.begin(), files.end());
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kint query replay\n");
+
+  std::vector<SMTConfig> configs;
+  for (auto &str: Configs) {
+    SMTConfig config;
+    if (!SMTConfig::parse(str, config)) {
+      errs() << "kint-replay: invalid configuration '" << str << "'\n";
+      return 1;
+    }
+    configs.push_back(config);
+  }
+  if (configs.empty())
+    configs.push_back(SMTConfig());
+
+  std::vector<std::string> queries;
+  if (!collectQueries(queries))
+    return 1;
+
+  auto &OS = outs();
+  OS << left_justify("query", 40);
+  for (auto &config: configs)
+    OS << "  " << right_justify(config.name, 16);
+  OS << "\n";
+
+  std::vector<double> totals(configs.size());
+  std::vector<unsigned> solved(configs.size());
+  unsigned disagreements = 0;
+
+  for (auto &path: queries) {
+    OS << left_justify(sys::path::filename(path), 40);
+    int32_t answer = BOOLECTOR_UNKNOWN;
+    bool disagree = false;
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+      double best = 0;
+      int32_t result = BOOLECTOR_UNKNOWN;
+      std::string err;
+
+      for (unsigned round = 0; round < std::max(1u, unsigned(Repeat)); ++round) {
+        SMTSolver solver(configs[i]);
+        auto start = std::chrono::steady_clock::now();
+        result = solver.smt_solve_file(path.c_str(), err);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (!round || elapsed.count() < best)
+          best = elapsed.count();
+        if (result == BOOLECTOR_PARSE_ERROR)
+          break;
+      }
+
+      if (result == BOOLECTOR_PARSE_ERROR) {
+        errs() << "kint-replay: " << path << ": " << err << "\n";
+        OS << "  " << right_justify("error", 16);
+        continue;
+      }
+
+      OS << "  " << format("%8.3f %-7s", best, getResultName(result));
+      totals[i] += best;
+      if (result != BOOLECTOR_SAT && result != BOOLECTOR_UNSAT)
+        continue;
+      ++solved[i];
+      // Configurations must never contradict each other.
+      if (answer != BOOLECTOR_UNKNOWN && answer != result)
+        disagree = true;
+      answer = result;
+    }
+
+    if (disagree) {
+      OS << "  DISAGREE";
+      ++disagreements;
+    }
+    OS << "\n";
+  }
+
+  OS << left_justify("total (" + std::to_string(queries.size()) + " queries)", 40);
+  for (size_t i = 0; i < configs.size(); ++i)
+    OS << "  " << format("%8.3f %3u sol", totals[i], solved[i]);
+  OS << "\n";
+
+  return disagreements ? 2 : 0;
+}
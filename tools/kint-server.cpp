@@ -0,0 +1,321 @@
+// Serves Kint runs over a Unix socket from one long-lived process, so that
+// the process start, plugin load and pass registration of opt are paid once,
+// and the state kept by -kint-persist (solver workers, summary indexes,
+// query verdicts) carries over from one file to the next. kint-client
+// submits a module with the arguments opt would take and gets back what the
+// run wrote to stderr, reports included.
+//
+// Requests are served one at a time. A run that crashes or hits a fatal
+// error is recovered from, and only fails its own request. After a crash
+// the server re-executes itself on the same socket, as the crashed run may
+// have left the persistent state half updated.
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/InitializePasses.h>
+#include <llvm/Pass.h>
+#include <llvm/PassInfo.h>
+#include <llvm/PassRegistry.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/PluginLoader.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "KintServer.h"
+
+using namespace llvm;
+using namespace kint_server;
+
+// Not cl::Required, as requests parse the options again without it
+static cl::opt<std::string> SocketPath("socket",
+  cl::desc("Unix socket to listen on"),
+  cl::value_desc("path"));
+
+static cl::opt<unsigned> MaxRequests("max-requests",
+  cl::desc("Exit after serving this many requests (0 = serve until killed)"),
+  cl::value_desc("n"), cl::init(0));
+
+static cl::opt<unsigned> MaxModuleMB("max-module-mb",
+  cl::desc("Largest module accepted, in MB"),
+  cl::value_desc("MB"), cl::init(1024));
+
+// Passed by the server to itself when it re-executes after a crash
+static cl::opt<int> ListenFD("listen-fd", cl::Hidden, cl::init(-1),
+  cl::desc("Serve on this listening socket instead of binding -socket"));
+
+static cl::opt<unsigned> Served("served", cl::Hidden, cl::init(0),
+  cl::desc("Requests already served toward -max-requests"));
+
+// Options of the server itself, and those that would exit it
+static bool isReserved(StringRef name) {
+  return name == "load" || name == "load-pass-plugin" || name == "socket" ||
+         name == "max-requests" || name == "max-module-mb" || name == "listen-fd" ||
+         name == "served" || name == "version" ||
+         name.startswith("help") || name.startswith("print-options") ||
+         name.startswith("print-all-options");
+}
+
+// A fatal error ends the request rather than the server.
+static void handleFatalError(void *, const char *reason, bool) {
+  errs() << "LLVM ERROR: " << reason << "\n";
+  if (auto *CRC = CrashRecoveryContext::GetCurrent())
+    CRC->HandleExit(1);
+}
+
+// Run the passes named in args over the module, as opt would with the rest
+// of args as options. Returns the exit status of opt.
+static int runRequest(ArrayRef<std::string> args, StringRef name, StringRef source) {
+  auto &Registry = *PassRegistry::getPassRegistry();
+  std::vector<const char *> argv{ "kint-server" };
+  std::vector<const PassInfo *> passes;
+
+  for (auto &arg: args) {
+    StringRef opt = StringRef(arg).ltrim('-');
+    StringRef optName = opt.split('=').first;
+    if (arg.empty() || arg[0] != '-' || isReserved(optName)) {
+      errs() << "kint-server: argument '" << arg << "' not allowed\n";
+      return 1;
+    }
+    if (optName == opt) {
+      if (auto *PI = Registry.getPassInfo(optName)) {
+        passes.push_back(PI);
+        continue;
+      }
+    }
+    argv.push_back(arg.c_str());
+  }
+
+  // Options start over from their defaults for every request.
+  cl::ResetAllOptionOccurrences();
+  if (!cl::ParseCommandLineOptions(argv.size(), argv.data(), "", &errs()))
+    return 1;
+
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  auto M = parseIR(MemoryBufferRef(source, name), Err, Ctx);
+  if (!M) {
+    Err.print("kint-server", errs());
+    return 1;
+  }
+  if (verifyModule(*M, &errs())) {
+    errs() << "kint-server: " << name << ": error: input module is broken!\n";
+    return 1;
+  }
+
+  legacy::PassManager PM;
+  for (auto *PI: passes)
+    PM.add(PI->createPass());
+  PM.run(*M);
+
+  if (AreStatisticsEnabled())
+    PrintStatistics(errs());
+  return 0;
+}
+
+// Read one request from fd, run it with stderr going to a temporary file,
+// and send that back. Returns whether the run crashed.
+static bool serve(int fd) {
+  char magic[sizeof(Magic)];
+  std::string cwd;
+  uint32_t count;
+  if (!readAll(fd, magic, sizeof(magic)) || memcmp(magic, Magic, sizeof(magic)) ||
+      !readString<uint32_t>(fd, cwd, MaxStringSize) ||
+      !readAll(fd, &count, sizeof(count)) || count > MaxStringSize)
+    return false;
+
+  std::vector<std::string> args(count);
+  std::string name, source;
+  for (auto &arg: args) {
+    if (!readString<uint32_t>(fd, arg, MaxStringSize))
+      return false;
+  }
+  if (!readString<uint32_t>(fd, name, MaxStringSize) ||
+      !readString<uint64_t>(fd, source, static_cast<uint64_t>(MaxModuleMB) << 20))
+    return false;
+
+  auto *capture = tmpfile();
+  if (!capture)
+    return false;
+  errs().flush();
+  int savedErr = dup(STDERR_FILENO);
+  dup2(fileno(capture), STDERR_FILENO);
+
+  // Relative paths in the arguments are the client's.
+  int status = 0;
+  bool crashed = false;
+  int savedDir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (savedDir < 0 || chdir(cwd.c_str())) {
+    errs() << "kint-server: cannot enter '" << cwd << "': " << strerror(errno) << "\n";
+    status = 1;
+  } else {
+    CrashRecoveryContext CRC;
+    if (!CRC.RunSafely([&]() { status = runRequest(args, name, source); })) {
+      // Fatal errors exit with 1, signals with 128 and their number.
+      status = CRC.RetCode ? CRC.RetCode : 1;
+      crashed = status > 128;
+      if (crashed)
+        errs() << "kint-server: the run of " << name << " crashed\n";
+    }
+    ResetStatistics();
+  }
+  if (savedDir >= 0) {
+    if (fchdir(savedDir))
+      errs() << "kint-server: cannot return to its directory: " << strerror(errno) << "\n";
+    close(savedDir);
+  }
+
+  errs().flush();
+  dup2(savedErr, STDERR_FILENO);
+  close(savedErr);
+
+  std::string output;
+  char buffer[4096];
+  rewind(capture);
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), capture)) > 0)
+    output.append(buffer, n);
+  fclose(capture);
+
+  uint32_t reply = status;
+  if (writeAll(fd, &reply, sizeof(reply)))
+    writeString<uint64_t>(fd, output);
+  return crashed;
+}
+
+// Kill and reap the children of this process: the solver workers, those of
+// the crashed run included, which would otherwise outlive it.
+static void killChildren() {
+  std::error_code EC;
+  for (sys::fs::directory_iterator it("/proc/self/task", EC), end; it != end && !EC;
+       it.increment(EC)) {
+    auto *F = fopen((it->path() + "/children").c_str(), "r");
+    if (!F)
+      continue;
+    int pid;
+    while (fscanf(F, "%d", &pid) == 1) {
+      kill(pid, SIGKILL);
+      while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+        ;
+    }
+    fclose(F);
+  }
+}
+
+// A crashed run may have left the state kept by -kint-persist (solver
+// workers, query verdicts, summary indexes) half updated, and the pass
+// holding the workers is gone. Start over as a fresh process serving the
+// same listening socket. Only returns if that fails.
+static void restart(ArrayRef<std::string> selfArgs, int listener, unsigned served) {
+  std::vector<std::string> args;
+  for (auto &arg: selfArgs) {
+    StringRef name = StringRef(arg).ltrim('-').split('=').first;
+    if (name != "listen-fd" && name != "served")
+      args.push_back(arg);
+  }
+  args.push_back("-listen-fd=" + std::to_string(listener));
+  args.push_back("-served=" + std::to_string(served));
+
+  std::vector<char *> argv;
+  for (auto &arg: args)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  killChildren();
+  errs().flush();
+  fcntl(listener, F_SETFD, fcntl(listener, F_GETFD) & ~FD_CLOEXEC);
+  execv("/proc/self/exe", argv.data());
+  errs() << "kint-server: cannot restart: " << strerror(errno) << "\n";
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> selfArgs(argv, argv + argc);
+  InitLLVM X(argc, argv);
+
+  auto &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeAnalysis(Registry);
+  initializeTransformUtils(Registry);
+  initializeScalarOpts(Registry);
+  initializeInstCombine(Registry);
+  initializeIPO(Registry);
+
+  // Plugins named with -load register their passes and options here.
+  cl::ParseCommandLineOptions(argc, argv, "Kint analysis server\n");
+  std::string path = SocketPath;
+  unsigned maxRequests = MaxRequests;
+  int listener = ListenFD;
+  unsigned served = Served;
+  int exitCode = 0;
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.empty()) {
+    errs() << "kint-server: no -socket given\n";
+    return 1;
+  }
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errs() << "kint-server: socket path too long\n";
+    return 1;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  if (listener >= 0) {
+    fcntl(listener, F_SETFD, fcntl(listener, F_GETFD) | FD_CLOEXEC);
+  } else {
+    // Left behind by a server that was killed
+    struct stat st;
+    if (!lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+      unlink(path.c_str());
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+        listen(listener, 16)) {
+      errs() << "kint-server: cannot listen on '" << path << "': " << strerror(errno) << "\n";
+      return 1;
+    }
+  }
+
+  CrashRecoveryContext::Enable();
+  install_fatal_error_handler(handleFatalError);
+
+  while (!maxRequests || served < maxRequests) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      errs() << "kint-server: accept failed: " << strerror(errno) << "\n";
+      break;
+    }
+    bool crashed = serve(fd);
+    close(fd);
+    ++served;
+    if (crashed && (!maxRequests || served < maxRequests)) {
+      restart(selfArgs, listener, served);
+      exitCode = 1;
+      break;
+    }
+  }
+
+  close(listener);
+  unlink(path.c_str());
+  return exitCode;
+}